@@ -0,0 +1,351 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* bidir.c -- bidirectional search meeting in the middle */
+
+/*
+ * For each bound, this search runs a depth-first search from the
+ * instance to a meeting depth, collecting the configurations at its
+ * frontier into a sorted struct cp_slice.  Then, a second depth-first
+ * search runs backwards from the solved configuration for the rest of
+ * the bound and looks up each of its frontier nodes in the forward
+ * frontier.  If the two frontiers meet, the bound is the length of an
+ * optimal solution.  Otherwise, the bound is increased by 2 and the
+ * process repeats.  Unlike IDA*, we cannot skip to the least f value
+ * exceeding the bound:  the part of a path between the two frontiers
+ * is never searched, so a longer solution may exist even if no node
+ * with an f value up to its length was pruned.
+ *
+ * The forward search is pruned with the catalogue's heuristic.  For
+ * the backwards search, we need a lower bound for the distance to the
+ * instance p instead.  As each PDB entry is a distance in the quotient
+ * graph of its tile set and as a move only moves tiles belonging to
+ * one PDB of a heuristic, the sum over |h_i(q) - h_i(p)| over all PDBs
+ * i belonging to a heuristic is such a lower bound for the distance
+ * between configurations q and p by the triangle inequality.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalogue.h"
+#include "compact.h"
+#include "fsm.h"
+#include "puzzle.h"
+#include "search.h"
+
+struct bidir_state {
+	jmp_buf finish;
+	struct pdb_catalogue *cat;
+	const struct fsm *fsm;
+	const struct partial_hvals *target;
+	struct cp_slice *frontier;
+	const struct compact_puzzle *want;
+	struct path *path;
+	size_t depth, bound;
+	unsigned long long expanded;
+};
+
+/*
+ * Compute a lower bound for the distance between the configuration
+ * whose partial h values are ph and the configuration whose partial
+ * h values are target.
+ */
+static unsigned
+differential_hval(struct pdb_catalogue *cat, const struct partial_hvals *ph,
+    const struct partial_hvals *target)
+{
+	size_t i, j;
+	unsigned long long parts;
+	unsigned max = 0, sum;
+
+	for (i = 0; i < cat->n_heuristics; i++) {
+		sum = 0;
+		for (parts = cat->parts[i]; parts != 0; parts &= parts - 1) {
+			j = ctzll(parts);
+			sum += ph->hvals[j] > target->hvals[j]
+			    ? ph->hvals[j] - target->hvals[j]
+			    : target->hvals[j] - ph->hvals[j];
+		}
+
+		if (sum > max)
+			max = sum;
+	}
+
+	return (max);
+}
+
+/*
+ * Search from p, which has been reached after g moves, until
+ * bst->depth moves have been made, pruning nodes whose f value exceeds
+ * bst->bound.  If bst->target is NULL, the heuristic estimates the
+ * distance to the solved configuration, otherwise the distance to the
+ * configuration whose partial h values bst->target are.  Each node at
+ * depth bst->depth is handled as follows:  if bst->want is not NULL
+ * and the node equals *bst->want, the search is finished.  Otherwise,
+ * if bst->target is NULL, the node is added to bst->frontier.  Else it
+ * is looked up in bst->frontier and the search is finished if it was
+ * found.  In both cases, the path leading to the node is recorded in
+ * bst->path.
+ */
+static void
+bidir_expand(struct bidir_state *bst, size_t g, struct puzzle *p,
+    struct fsm_state st, struct partial_hvals *ph)
+{
+	struct partial_hvals pph;
+	struct fsm_state ast;
+	struct compact_puzzle cp;
+	size_t i, h, n_moves, zloc, dest, tile;
+	const signed char *moves;
+
+	if (bst->target == NULL)
+		h = catalogue_ph_hval(bst->cat, ph);
+	else
+		h = differential_hval(bst->cat, ph, bst->target);
+
+	if (g + h > bst->bound)
+		return;
+
+	if (g == bst->depth) {
+		pack_puzzle(&cp, p);
+		bst->path->pathlen = g;
+
+		if (bst->want != NULL) {
+			if (compare_cp_nomask(&cp, bst->want) == 0)
+				longjmp(bst->finish, 1);
+		} else if (bst->target == NULL)
+			cps_append(bst->frontier, &cp);
+		else {
+			bst->want = bsearch(&cp, bst->frontier->data,
+			    bst->frontier->len, sizeof cp, compare_cp_nomask);
+			if (bst->want != NULL)
+				longjmp(bst->finish, 1);
+		}
+
+		return;
+	}
+
+	fsm_prefetch(bst->fsm, st);
+	bst->expanded++;
+	zloc = zero_location(p);
+	moves = get_moves(zloc);
+	n_moves = move_count(zloc);
+
+	for (i = 0; i < n_moves; i++) {
+		ast = fsm_advance_idx(bst->fsm, st, i);
+		if (fsm_is_match(ast))
+			continue;
+
+		dest = moves[i];
+		bst->path->moves[g] = dest;
+
+		tile = p->grid[dest];
+		move(p, dest);
+		pph = *ph;
+		catalogue_diff_hvals(&pph, bst->cat, p, tile);
+		bidir_expand(bst, g + 1, p, ast, &pph);
+		move(p, zloc);
+	}
+}
+
+/*
+ * Run bidir_expand() from p with the given depth.  Return 1 if the
+ * search was finished early, 0 otherwise.
+ */
+static int
+bidir_run(struct bidir_state *bst, const struct puzzle *p, size_t depth)
+{
+	struct partial_hvals ph;
+	struct puzzle pp;
+
+	bst->depth = depth;
+	if (setjmp(bst->finish))
+		return (1);
+
+	pp = *p;
+	catalogue_partial_hvals(&ph, bst->cat, &pp);
+	bidir_expand(bst, 0, &pp, fsm_start_state(zero_location(&pp)), &ph);
+
+	return (0);
+}
+
+/*
+ * Sort frontier and remove duplicate entries.
+ */
+static void
+sort_frontier(struct cp_slice *frontier)
+{
+	size_t i, j;
+
+	qsort(frontier->data, frontier->len, sizeof *frontier->data, compare_cp_nomask);
+
+	for (i = j = 0; i < frontier->len; i++)
+		if (j == 0 || compare_cp_nomask(frontier->data + j - 1, frontier->data + i) != 0)
+			frontier->data[j++] = frontier->data[i];
+
+	frontier->len = j;
+}
+
+/*
+ * Search for an optimal solution for p with a bidirectional search,
+ * using the PDBs in cat as heuristics and fsm to eliminate duplicate
+ * nodes in both directions.  The PDBs in cat must store exact
+ * distances in their respective quotient graphs, i.e. they must not be
+ * lossy.  The interface is the same as for search_ida_bounded(), but
+ * only one solution is reported to on_solved and IDA_LAST_FULL is
+ * ignored.  As the search meets at the first bound for which a path
+ * exists, the solution found is optimal.  Return the number of nodes
+ * expanded.  Note that the memory needed grows with the number of
+ * nodes half way through the search.
+ */
+extern unsigned long long
+search_bidir(struct pdb_catalogue *cat, const struct fsm *fsm,
+    const struct puzzle *p, size_t limit, struct path *path,
+    void (*on_solved)(const struct path *, void *), void *payload, int flags)
+{
+	struct bidir_state bst;
+	struct partial_hvals target;
+	struct cp_slice frontier;
+	struct compact_puzzle want;
+	struct path back;
+	struct puzzle pp;
+	unsigned long long total_expanded = 0, fwd_expanded, bwd_expanded;
+	double estimate;
+	size_t bound, i, back_depth = 0;
+	int found = 0;
+
+	cps_init(&frontier);
+	catalogue_partial_hvals(&target, cat, p);
+
+	bst.cat = cat;
+	bst.fsm = fsm;
+	bst.frontier = &frontier;
+
+	path->pathlen = SEARCH_NO_PATH;
+	bound = catalogue_ph_hval(cat, &target);
+	for (; bound <= limit; bound += 2) {
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Searching for solution with bound %zu, meeting at depth %zu\n",
+			    bound, bound - back_depth);
+
+		/* forward search to the meeting depth */
+		frontier.len = 0;
+		bst.target = NULL;
+		bst.want = NULL;
+		bst.path = path;
+		bst.bound = bound;
+		bst.expanded = 0;
+		bidir_run(&bst, p, bound - back_depth);
+		sort_frontier(&frontier);
+		fwd_expanded = bst.expanded;
+
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Forward frontier holds %zu configurations.\n", frontier.len);
+
+		/* backward search from the solved configuration */
+		bst.target = &target;
+		bst.path = &back;
+		bst.expanded = 0;
+		found = bidir_run(&bst, &solved_puzzle, back_depth);
+		bwd_expanded = bst.expanded;
+		total_expanded += fwd_expanded + bwd_expanded;
+
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Expanded %llu + %llu nodes during previous round.\n",
+			    fwd_expanded, bwd_expanded);
+
+		if (found)
+			break;
+
+		/*
+		 * The backwards heuristic is usually much weaker than the
+		 * forwards heuristic, so an even split wastes effort.
+		 * Instead, move the meeting depth towards the cheaper
+		 * direction, assuming that each extra level multiplies
+		 * the backwards effort by the branching factor.  The
+		 * forward search absorbs the increase in bound.
+		 */
+		if (bwd_expanded > fwd_expanded) {
+			if (back_depth > 0)
+				back_depth--;
+		} else
+			for (estimate = bwd_expanded + 1; estimate * B < fwd_expanded
+			    && back_depth < bound; estimate *= B)
+				back_depth++;
+	}
+
+	if (found) {
+		/* recover the forward half of the path */
+		want = *bst.want;
+		bst.target = NULL;
+		bst.want = &want;
+		bst.path = path;
+		bst.expanded = 0;
+		if (!bidir_run(&bst, p, bound - back_depth)) {
+			fprintf(stderr, "Cannot recover forward path!\n");
+			abort();
+		}
+
+		total_expanded += bst.expanded;
+
+		/* append the backward half in reverse */
+		for (i = 0; i < back.pathlen; i++)
+			path->moves[path->pathlen + i] = i + 1 < back.pathlen
+			    ? back.moves[back.pathlen - i - 2]
+			    : zero_location(&solved_puzzle);
+
+		path->pathlen += back.pathlen;
+	}
+
+	cps_free(&frontier);
+
+	if (flags & IDA_VERBOSE) {
+		fprintf(stderr, "Expanded %llu nodes in total.\n", total_expanded);
+		if (found)
+			fprintf(stderr, "Found optimal solution of length %zu.\n", path->pathlen);
+		else
+			fprintf(stderr, "No solution found.\n");
+	}
+
+	if (found && flags & IDA_VERIFY) {
+		pp = *p;
+		path_walk(&pp, path);
+		if (path->pathlen != bound
+		    || memcmp(pp.tiles, solved_puzzle.tiles, TILE_COUNT) != 0) {
+			if (flags & IDA_VERBOSE)
+				fprintf(stderr, "Path incorrect!\n");
+
+			abort();
+		}
+	}
+
+	if (found && on_solved != NULL)
+		on_solved(path, payload);
+
+	return (total_expanded);
+}
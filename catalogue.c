@@ -66,7 +66,10 @@ add_pdb(struct pdb_catalogue *cat, const char *tsbuf, const char *pdbdir,
 		return (-1);
 	}
 
-	if (tileset_has(ts, ZERO_TILE)) {
+	if (ts == FULL_TILESET) {
+		heutype = "ball";
+		ts = tileset_remove(ts, ZERO_TILE);
+	} else if (tileset_has(ts, ZERO_TILE)) {
 		heutype = flags & CAT_IDENTIFY ? "ipdb" : "zpdb";
 		ts = tileset_remove(ts, ZERO_TILE);
 	}
@@ -109,8 +112,10 @@ add_pdb(struct pdb_catalogue *cat, const char *tsbuf, const char *pdbdir,
  * so the order of components should be the same every time.  If the
  * same PDB is used in multiple heuristics, it is loaded only once
  * still.  For better performance, the PDB is loaded as a memory mapped
- * file.  On error, NULL is returned and errno set to indicate the
- * problem.
+ * file.  A group made of the full tile set including the zero tile
+ * denotes an endgame database loaded from a perimeter file, see
+ * ball_driver() in heuristic.c.  On error, NULL is returned and errno
+ * set to indicate the problem.
  */
 extern struct pdb_catalogue *
 catalogue_load(const char *catfile, const char *pdbdir, int flags, FILE *f)
@@ -264,6 +269,44 @@ catalogue_partial_hvals(struct partial_hvals *ph,
 		ph->hvals[i] = heu_hval(cat->heus + i, p);
 }
 
+/*
+ * Fill in ph[0] to ph[n - 1] with the partial h values for the n
+ * puzzle configurations p[0] to p[n - 1] relative to PDB catalogue
+ * cat.  The result is the same as calling catalogue_partial_hvals()
+ * on each configuration, but the lookups are done one PDB at a time
+ * for all configurations.  This way, the tables of each PDB are only
+ * touched once per batch and the lookups can be overlapped.
+ */
+extern void
+catalogue_partial_hvals_batch(struct partial_hvals *ph,
+    struct pdb_catalogue *cat, const struct puzzle *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < cat->n_heus; i++)
+		heu_hvals(cat->heus + i, &ph->hvals[i], sizeof *ph, p, n);
+}
+
+/*
+ * Store the h values predicted by cat for the n puzzle configurations
+ * p[0] to p[n - 1] to hvals[0] to hvals[n - 1].  This is the batched
+ * equivalent of catalogue_hval().
+ */
+extern void
+catalogue_hvals(unsigned *hvals, struct pdb_catalogue *cat,
+    const struct puzzle *p, size_t n)
+{
+	struct partial_hvals ph[CATALOGUE_BATCH_LEN];
+	size_t i, j, len;
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < CATALOGUE_BATCH_LEN ? n - i : CATALOGUE_BATCH_LEN;
+		catalogue_partial_hvals_batch(ph, cat, p + i, len);
+		for (j = 0; j < len; j++)
+			hvals[i + j] = catalogue_ph_hval(cat, ph + j);
+	}
+}
+
 /*
  * Update ph, a struct partial_hvals for a configuration neighboring p
  * by moving tile t, to contain partial h values for p.  To save time,
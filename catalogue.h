@@ -51,6 +51,9 @@ enum {
 	CATALOGUE_HEUS_LEN = 64,
 	HEURISTICS_LEN = 64,
 
+	/* number of configurations processed at once by catalogue_hvals() */
+	CATALOGUE_BATCH_LEN = 256,
+
 	/* flags for catalogue_load() */
 	CAT_IDENTIFY = 1 << 0,
 };
@@ -79,6 +82,8 @@ extern struct pdb_catalogue	*catalogue_load(const char *, const char *, int, FIL
 extern void	catalogue_free(struct pdb_catalogue *);
 extern int	catalogue_add_transpositions(struct pdb_catalogue *cat);
 extern void	catalogue_partial_hvals(struct partial_hvals *, struct pdb_catalogue *, const struct puzzle *);
+extern void	catalogue_partial_hvals_batch(struct partial_hvals *, struct pdb_catalogue *, const struct puzzle *, size_t);
+extern void	catalogue_hvals(unsigned *, struct pdb_catalogue *, const struct puzzle *, size_t);
 extern void	catalogue_diff_hvals(struct partial_hvals *, struct pdb_catalogue *, const struct puzzle *, unsigned);
 
 /*
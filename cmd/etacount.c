@@ -40,8 +40,54 @@
 #include "match.h"
 #include "statistics.h"
 
-// TODO: Make code account for parity correctly.
+/*
+ * This program computes eta exactly for an additive heuristic made of
+ * four disjoint PDBs with six tiles each.  Each PDB is first reduced to
+ * a vector of cohort etas, i.e. the sum of b^-h over all entries of a
+ * cohort.  As only half of all configurations are solvable, the sums
+ * are kept separately for even and odd permutations of the PDB's
+ * tiles.  Next, the vectors for the first two and the last two PDBs
+ * are joined into half etas for twelve-tile cohorts.  Finally, the
+ * two halves are joined into eta, considering only those combinations
+ * that form solvable configurations.
+ *
+ * To determine the parity of a configuration from its parts, the tiles
+ * are relabeled such that the tiles of the first PDB come first, then
+ * those of the second PDB and so on.  With this labeling, the parity
+ * of a configuration is the sum of the parities of each PDB's tile
+ * permutation plus the number of pairs of grid locations occupied by
+ * tiles from different PDBs that are out of order.  The latter only
+ * depends on the tile maps.  Relabeling changes the parity by a
+ * constant, the parity of the relabeling permutation.
+ *
+ * All intermediate results are kept in double precision.  As all terms
+ * are positive, the relative error of the result is bounded by a
+ * small multiple of the machine epsilon per step.  The final sum is
+ * computed with compensated summation in a fixed order so the result
+ * does not depend on the number of threads.
+ *
+ * With -b, the result can be checked against the estimate of
+ * cmd/sampleeta for the same PDBs.  With b = B, eta is dominated by
+ * configurations far too rare to ever be sampled, so the estimate
+ * falls short of eta by far more than its error estimate.  With a
+ * smaller base given to both programs with -B, the two agree within
+ * the error estimate.  For the PDBs 1-6, 7-12, 13-18 and 19-24 in
+ * catalogue r6.cat,
+ *
+ *     etacount -b -B 1.5 -d pdbdir 1,2,3,4,5,6 7,8,9,10,11,12 \
+ *         13,14,15,16,17,18 19,20,21,22,23,24
+ *
+ * gives eta = 2.602914e-12 while
+ *
+ *     sampleeta -B 1.5 -s seed -r 100000000 -d pdbdir \
+ *         -p spheres/s r6.cat
+ *
+ * gives 2.597375e-12, 2.599468e-12 and 2.580151e-12 with an error of
+ * about 2e-14 for seeds 1, 2 and 3.
+ */
 
+/* the base b of eta, see -B */
+static double base = B;
 
 /*
  * dummy bias values for no bias
@@ -55,125 +101,167 @@ static const double no_bias[TILE_COUNT] = {
 };
 
 /*
- * This function works just like make_cohort_etas but for APDBs instead
- * of ZPDBs.
+ * Return the parity of the number of pairs of grid locations (a, b)
+ * with a in map_a, b in map_b, and a > b.  This is the parity of the
+ * number of inversions between tiles on map_a and tiles on map_b if
+ * all tiles on map_a have lower numbers than the tiles on map_b.
  */
-static float *
-make_cohort_etas_nz(struct patterndb *pdb)
+static unsigned
+cross_parity(tileset map_a, tileset map_b)
 {
-	struct index_aux aux;
-	size_t histogram[PDB_HISTOGRAM_LEN];
-	size_t i, j;
-	double eta;
-	float *etas;
-	const atomic_uchar *table;
+	unsigned n = 0;
 
-	make_index_aux(&aux, tileset_add(pdb->aux.ts, ZERO_TILE));
+	for (; !tileset_empty(map_b); map_b = tileset_remove_least(map_b))
+		n += tileset_count(tileset_difference(map_a,
+		    tileset_least(tileset_get_least(map_b) + 1)));
 
-	etas = malloc(eqclass_total(&aux) * sizeof *etas);
-	if (etas == NULL)
-		return (NULL);
+	return (n & 1);
+}
 
-	for (i = 0; i < pdb->aux.n_maprank; i++) {
-		memset(histogram, 0, sizeof histogram);
-		table = pdb->data + i * pdb->aux.n_perm;
-		for (j = 0; j < pdb->aux.n_perm; j++)
-			histogram[table[j]]++;
+/*
+ * Return the parity of the permutation with permutation index pidx
+ * for a PDB with n_tile tiles.  The permutation index is a number in
+ * the factorial number system whose digits are the inversion counts of
+ * the tiles (see index_permutation() in index.c), so the parity is the
+ * parity of the digit sum.
+ */
+static unsigned
+pidx_parity(permindex pidx, unsigned n_tile)
+{
+	unsigned parity = 0;
+
+	for (; n_tile > 0; n_tile--) {
+		parity ^= pidx % n_tile & 1;
+		pidx /= n_tile;
+	}
+
+	return (parity);
+}
 
-		eta = 0.0;
-		for (j = 1; j <= PDB_HISTOGRAM_LEN; j++)
-			eta = histogram[PDB_HISTOGRAM_LEN - j] + eta * (1.0 / B);
+/*
+ * Return the parity of relabeling the tiles such that the tiles in
+ * ts[0] come first, then those in ts[1] and so on.
+ */
+static unsigned
+relabel_parity(const tileset ts[4])
+{
+	unsigned n = 0;
+	size_t i;
+	tileset prev = EMPTY_TILESET, cur;
+
+	for (i = 0; i < 4; i++) {
+		/* count tiles from earlier PDBs with higher numbers */
+		for (cur = tileset_remove(ts[i], ZERO_TILE); !tileset_empty(cur);
+		    cur = tileset_remove_least(cur))
+			n += tileset_count(tileset_difference(prev,
+			    tileset_least(tileset_get_least(cur) + 1)));
 
-		for (j = 0; j < aux.idxt[i].n_eqclass; j++)
-			etas[aux.idxt[i].offset + j] = eta;
+		prev = tileset_union(prev, tileset_remove(ts[i], ZERO_TILE));
 	}
 
-	return (etas);
+	return (n & 1);
 }
 
 /*
- * This function computes the partial eta value for each cohort.  The
- * resulting partial eta values are unscaled, instead the result of
- * the computation is scaled at the end.
+ * Configuration structure for cohort_eta_worker.  aux is an index_aux
+ * structure for the PDB's tile set plus the zero tile, parities holds
+ * the permutation parity for each permutation index.
  */
-static float *
-make_cohort_etas(struct patterndb *pdb)
+struct cohort_eta_config {
+	struct parallel_config pcfg;
+	struct index_aux aux;
+	double *etas;
+	unsigned char *parities;
+};
+
+/*
+ * Compute the even and odd cohort etas for idx->maprank.  For APDBs,
+ * the same values are stored for every equivalence class of the map.
+ */
+static void
+cohort_eta_worker(void *cfgarg, struct index *idx)
 {
-	size_t i, j, n_tables;
-	size_t histogram[PDB_HISTOGRAM_LEN];
-	double eta;
-	float *etas;
+	struct cohort_eta_config *cfg = cfgarg;
+	const struct index_aux *aux = &cfg->pcfg.pdb->aux;
+	size_t histogram[2][PDB_HISTOGRAM_LEN];
+	size_t i, j, offset, n_eqclass;
+	double eta[2];
 	const atomic_uchar *table;
 
-	// TODO: Adapt code to work with APDBs, not just ZPDBs.
-	if (!tileset_has(pdb->aux.ts, ZERO_TILE))
-		return (make_cohort_etas_nz(pdb));
+	n_eqclass = eqclass_count(&cfg->aux, idx->maprank);
+	for (idx->eqidx = 0; idx->eqidx < n_eqclass; idx->eqidx++) {
+		offset = cfg->aux.idxt[idx->maprank].offset + idx->eqidx;
 
-	n_tables = eqclass_total(&pdb->aux);
-	etas = malloc(n_tables * sizeof *etas);
-	if (etas == NULL)
-		return (NULL);
+		/* APDBs have only one table per map */
+		if (idx->eqidx > 0 && !tileset_has(aux->ts, ZERO_TILE)) {
+			cfg->etas[2 * offset + 0] = eta[0];
+			cfg->etas[2 * offset + 1] = eta[1];
+			continue;
+		}
 
-	for (i = 0; i < n_tables; i++) {
 		memset(histogram, 0, sizeof histogram);
-		table = pdb->data + i * pdb->aux.n_perm;
-		for (j = 0; j < pdb->aux.n_perm; j++)
-			histogram[table[j]]++;
+		table = pdb_entry_pointer(cfg->pcfg.pdb, idx);
+		for (i = 0; i < aux->n_perm; i++)
+			histogram[cfg->parities[i]][table[i]]++;
 
-		eta = 0.0;
-		for (j = 1; j <= PDB_HISTOGRAM_LEN; j++)
-			eta = histogram[PDB_HISTOGRAM_LEN - j] + eta * (1.0 / B);
+		for (j = 0; j < 2; j++) {
+			eta[j] = 0.0;
+			for (i = 1; i <= PDB_HISTOGRAM_LEN; i++)
+				eta[j] = histogram[j][PDB_HISTOGRAM_LEN - i] + eta[j] * (1.0 / base);
 
-		etas[i] = eta;
+			cfg->etas[2 * offset + j] = eta[j];
+		}
 	}
-
-	return (etas);
 }
 
 /*
- * Return the product of the table entries corresponding to maps
- * map_a and map_b with the zero tile at zloc.
+ * This function computes the partial eta value for each cohort,
+ * separately for even and odd tile permutations.  The entry for
+ * parity p of the cohort with offset i is stored at index 2 * i + p.
+ * Cohorts are indexed as in a ZPDB for the PDB's tile set, even if pdb
+ * is an APDB.  The resulting partial eta values are unscaled, instead
+ * the result of the computation is scaled at the end.
  */
-static float
-join_etas(tileset map_a, tileset map_b, unsigned zloc,
-    const float *restrict etas_a, const float *restrict etas_b,
-    struct index_aux *aux)
+static double *
+make_cohort_etas(struct patterndb *pdb)
 {
-	tsrank rank_a, rank_b;
-	size_t off_a, off_b;
+	struct cohort_eta_config cfg;
+	permindex i;
+
+	make_index_aux(&cfg.aux, tileset_add(pdb->aux.ts, ZERO_TILE));
+	cfg.pcfg.pdb = pdb;
+	cfg.pcfg.worker = cohort_eta_worker;
 
-	rank_a = tileset_rank(map_a);
-	rank_b = tileset_rank(map_b);
+	cfg.parities = malloc(pdb->aux.n_perm);
+	if (cfg.parities == NULL)
+		return (NULL);
 
-	off_a = aux->idxt[rank_a].offset + aux->idxt[rank_a].eqclasses[zloc];
-	off_b = aux->idxt[rank_b].offset + aux->idxt[rank_b].eqclasses[zloc];
+	for (i = 0; i < pdb->aux.n_perm; i++)
+		cfg.parities[i] = pidx_parity(i, pdb->aux.n_tile);
 
-	return (etas_a[off_a] * etas_b[off_b]);
+	cfg.etas = malloc(2 * eqclass_total(&cfg.aux) * sizeof *cfg.etas);
+	if (cfg.etas == NULL) {
+		free(cfg.parities);
+		return (NULL);
+	}
+
+	pdb_iterate_parallel(&cfg.pcfg);
+	free(cfg.parities);
+
+	return (cfg.etas);
 }
 
 /*
- * Compute the partial eta for all possible subdivisions of map (a tileset
- * of 12 tiles), assuming the zero tile is at zloc.  Return the computed
- * partial eta.  aux6 is a pointer to an index_aux structure for a six
- * tiles ZPDB.
+ * Return a pointer to the pair of even and odd partial etas in etas
+ * for the cohort of map with the zero tile at zloc.
  */
-static double
-single_map_eta(const float *restrict etas_a, const float *restrict etas_b,
-    tileset map, unsigned zloc, struct index_aux *aux6)
+static const double *
+cohort_pair(const double *etas, tileset map, unsigned zloc,
+    const struct index_aux *aux)
 {
-	double eta = 0.0;
-	size_t i;
-	tileset map_a, map_b;
-	enum { SIX_OF_TWELVE = 924 }; /* 12 choose 6 */
+	tsrank rank = tileset_rank(map);
 
-	for (i = 0; i < SIX_OF_TWELVE; i++) {
-		map_a = pdep(map, tileset_unrank(6, i));
-		map_b = tileset_difference(map, map_a);
-
-		eta += join_etas(map_a, map_b, zloc, etas_a, etas_b, aux6);
-	}
-
-	return (eta);
+	return (etas + 2 * (aux->idxt[rank].offset + aux->idxt[rank].eqclasses[zloc]));
 }
 
 /*
@@ -181,39 +269,67 @@ single_map_eta(const float *restrict etas_a, const float *restrict etas_b,
  */
 struct half_eta_config {
 	struct parallel_config pcfg;
-	const float *restrict etas_a, *restrict etas_b;
-	float *etas;
+	const double *restrict etas_a, *restrict etas_b;
+	double *etas;
 	struct index_aux aux6;
 };
 
 /*
- * Combine cohort vectors etas_a and etas_b for idx->maprank.  This is
+ * Combine cohort vectors etas_a and etas_b for idx->maprank by summing
+ * the products of the partial etas over all possible subdivisions of
+ * the map (a tileset of 12 tiles) into two maps of six tiles.  This is
  * the worker function for make_half_etas().
  */
 static void
 half_eta_worker(void *cfgarg, struct index *idx)
 {
 	struct half_eta_config *cfg = cfgarg;
-	size_t offset, n_eqclass;
-	tileset map;
+	const struct index_aux *aux = &cfg->pcfg.pdb->aux;
+	const double *a, *b;
+	double eta[TILE_COUNT][2];
+	size_t i, j, offset, n_eqclass;
+	unsigned zlocs[TILE_COUNT], parity;
+	tileset map, map_a, map_b;
+	enum { SIX_OF_TWELVE = 924 }; /* 12 choose 6 */
 
-	n_eqclass = eqclass_count(&cfg->pcfg.pdb->aux, idx->maprank);
+	n_eqclass = eqclass_count(aux, idx->maprank);
 	map = tileset_unrank(12, idx->maprank);
 
 	for (idx->eqidx = 0; idx->eqidx < n_eqclass; idx->eqidx++) {
-		offset = cfg->pcfg.pdb->aux.idxt[idx->maprank].offset + idx->eqidx;
-		cfg->etas[offset] = single_map_eta(cfg->etas_a, cfg->etas_b, map,
-		    canonical_zero_location(&cfg->pcfg.pdb->aux, idx), &cfg->aux6);
+		zlocs[idx->eqidx] = canonical_zero_location(aux, idx);
+		eta[idx->eqidx][0] = 0.0;
+		eta[idx->eqidx][1] = 0.0;
+	}
+
+	for (i = 0; i < SIX_OF_TWELVE; i++) {
+		map_a = pdep(map, tileset_unrank(6, i));
+		map_b = tileset_difference(map, map_a);
+		parity = cross_parity(map_a, map_b);
+
+		for (j = 0; j < n_eqclass; j++) {
+			a = cohort_pair(cfg->etas_a, map_a, zlocs[j], &cfg->aux6);
+			b = cohort_pair(cfg->etas_b, map_b, zlocs[j], &cfg->aux6);
+
+			eta[j][parity] += a[0] * b[0] + a[1] * b[1];
+			eta[j][!parity] += a[0] * b[1] + a[1] * b[0];
+		}
+	}
+
+	for (j = 0; j < n_eqclass; j++) {
+		offset = aux->idxt[idx->maprank].offset + j;
+		cfg->etas[2 * offset + 0] = eta[j][0];
+		cfg->etas[2 * offset + 1] = eta[j][1];
 	}
 }
 
 /*
  * Combine cohort eta vectors etas_a and etas_b into a vector containing
- * partial eta values for all possible combinations of the two.  pdbdummy
- * is a pointer to an arbitrary 12 tile dummy ZPDB.
+ * partial eta values for all possible combinations of the two, again
+ * separately for even and odd permutations.  pdbdummy is a pointer to
+ * an arbitrary 12 tile dummy ZPDB.
  */
-static float *
-make_half_etas(const float *restrict etas_a, const float *restrict etas_b,
+static double *
+make_half_etas(const double *restrict etas_a, const double *restrict etas_b,
     struct patterndb *pdbdummy)
 {
 	struct half_eta_config cfg;
@@ -227,7 +343,7 @@ make_half_etas(const float *restrict etas_a, const float *restrict etas_b,
 	cfg.etas_b = etas_b;
 
 	n_tables = eqclass_total(&pdbdummy->aux);
-	cfg.etas = malloc(n_tables * sizeof *cfg.etas);
+	cfg.etas = malloc(2 * n_tables * sizeof *cfg.etas);
 	if (cfg.etas == NULL)
 		return (NULL);
 
@@ -237,46 +353,103 @@ make_half_etas(const float *restrict etas_a, const float *restrict etas_b,
 }
 
 /*
- * Combine the contents of eta arrays half_etas[0] and half_etas[1] into
- * a single eta.  pdbdummy is a pointer to an arbitrary 12 tile ZPDB.
- * bias is an array of doubles weighting entries according to the zero
- * tile location.  This can be used to model an equilibrium distribution.
+ * Configuration structure for eta_worker.  sums receives one partial
+ * sum per maprank of pdbdummy.
  */
-static double
-make_eta(const float *restrict etas_a, const float *restrict etas_b,
-    struct patterndb *pdbdummy, const double bias[TILE_COUNT])
+struct eta_config {
+	struct parallel_config pcfg;
+	const double *restrict etas_a, *restrict etas_b;
+	const double *bias;
+	double *sums;
+	unsigned relabel_parity;
+};
+
+/*
+ * Join the half etas for all solvable configurations where the tiles
+ * of the first two PDBs occupy the map with rank idx->maprank.  This is
+ * the worker function for make_eta().
+ */
+static void
+eta_worker(void *cfgarg, struct index *idx)
 {
-	struct index_aux *aux = &pdbdummy->aux;
-	struct index idx;
-	double eta = 0.0, sum;
-	unsigned zloc;
+	struct eta_config *cfg = cfgarg;
+	const struct index_aux *aux = &cfg->pcfg.pdb->aux;
+	const double *a, *b;
+	double sum = 0.0;
+	unsigned zloc, parity;
 	tileset map_a, map_b, cmap;
 
-	idx.pidx = 0;
-	for (idx.maprank = 0; idx.maprank < aux->n_maprank; idx.maprank++) {
-		sum = 0.0;
-		map_a = tileset_unrank(12, idx.maprank);
+	map_a = tileset_unrank(12, idx->maprank);
 
-		for (cmap = tileset_complement(map_a); !tileset_empty(cmap);
-		    cmap = tileset_remove_least(cmap)) {
-			zloc = tileset_get_least(cmap);
-			map_b = tileset_remove(tileset_complement(map_a), zloc);
+	for (cmap = tileset_complement(map_a); !tileset_empty(cmap);
+	    cmap = tileset_remove_least(cmap)) {
+		zloc = tileset_get_least(cmap);
+		map_b = tileset_remove(tileset_complement(map_a), zloc);
 
-			sum += join_etas(map_a, map_b, zloc, etas_a, etas_b, aux) * bias[zloc];
-		}
+		/* the configuration is solvable iff its parity is even */
+		parity = cfg->relabel_parity ^ cross_parity(map_a, map_b);
+		a = cohort_pair(cfg->etas_a, map_a, zloc, aux);
+		b = cohort_pair(cfg->etas_b, map_b, zloc, aux);
+
+		sum += (a[0] * b[parity] + a[1] * b[!parity]) * cfg->bias[zloc];
+	}
 
-		/* increase precision slightly by keeping track of sum separately */
-		eta += sum;
+	cfg->sums[idx->maprank] = sum;
+}
+
+/*
+ * Combine the contents of eta arrays etas_a and etas_b into a single
+ * eta.  pdbdummy is a pointer to an arbitrary 12 tile ZPDB.  bias is an
+ * array of doubles weighting entries according to the zero tile
+ * location.  This can be used to model an equilibrium distribution.
+ * relabel_parity is the parity of the tile relabeling described at the
+ * beginning of this file.  Return a negative number if we run out of
+ * memory.
+ */
+static double
+make_eta(const double *restrict etas_a, const double *restrict etas_b,
+    struct patterndb *pdbdummy, const double bias[TILE_COUNT],
+    unsigned relabel_parity)
+{
+	struct eta_config cfg;
+	double eta = 0.0, comp = 0.0, t;
+	size_t i;
+
+	cfg.pcfg.pdb = pdbdummy;
+	cfg.pcfg.worker = eta_worker;
+	cfg.etas_a = etas_a;
+	cfg.etas_b = etas_b;
+	cfg.bias = bias;
+	cfg.relabel_parity = relabel_parity;
+
+	cfg.sums = malloc(pdbdummy->aux.n_maprank * sizeof *cfg.sums);
+	if (cfg.sums == NULL)
+		return (-1.0);
+
+	pdb_iterate_parallel(&cfg.pcfg);
+
+	/* Neumaier summation */
+	for (i = 0; i < pdbdummy->aux.n_maprank; i++) {
+		t = eta + cfg.sums[i];
+		if (eta >= cfg.sums[i])
+			comp += (eta - t) + cfg.sums[i];
+		else
+			comp += (cfg.sums[i] - t) + eta;
+
+		eta = t;
 	}
 
-	/* scale by 25! */
-	return (eta * 6.446950284384474737e-26);
+	free(cfg.sums);
+
+	/* scale by 25!/2, the number of solvable configurations */
+	return ((eta + comp) * (2.0 * 6.446950284384474737e-26));
 }
 
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-biq] [-Q qualities.txt] [-d pdbdir] [-j nproc] tileset tileset tileset tileset\n", argv0);
+	fprintf(stderr, "Usage: %s [-biq] [-B base] [-Q qualities.txt] [-d pdbdir] [-j nproc]\n"
+	    "    tileset tileset tileset tileset\n", argv0);
 	exit(EXIT_FAILURE);
 }
 
@@ -288,14 +461,23 @@ main(int argc, char *argv[])
 	struct quality *qualities = NULL, partq[4];
 
 	double eta, fake_eta, havg;
-	float *cohort_etas[4], *half_etas[2];
+	double *cohort_etas[4], *half_etas[2];
 	size_t i;
 	int quiet = 0, optchar, identify = 0, bias = 0;
-	tileset ts, accum = EMPTY_TILESET;
+	tileset ts[4], accum = EMPTY_TILESET;
 	const char *pdbdir = NULL, *pdbtype;
 
-	while (optchar = getopt(argc, argv, "Q:bd:ij:q"), optchar != -1)
+	while (optchar = getopt(argc, argv, "B:Q:bd:ij:q"), optchar != -1)
 		switch (optchar) {
+		case 'B':
+			base = strtod(optarg, NULL);
+			if (!(base > 1.0)) {
+				fprintf(stderr, "Base must be larger than 1: %s\n", optarg);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
 		case 'Q':
 			qualities = qualities_load(optarg);
 			if (qualities == NULL) {
@@ -339,24 +521,24 @@ main(int argc, char *argv[])
 		usage(argv[0]);
 
 	for (i = 0; i < 4; i++) {
-		if (tileset_parse(&ts, argv[optind + i]) != 0) {
+		if (tileset_parse(ts + i, argv[optind + i]) != 0) {
 			fprintf(stderr, "Cannot parse tile set: %s\n", argv[optind + i]);
 			return (EXIT_FAILURE);
 		}
 
-		if (tileset_count(tileset_remove(ts, ZERO_TILE)) != 6) {
+		if (tileset_count(tileset_remove(ts[i], ZERO_TILE)) != 6) {
 			fprintf(stderr, "Tileset needs to have six tiles: %s\n", argv[optind + i]);
 			return (EXIT_FAILURE);
 		}
 
-		if (!tileset_empty(tileset_remove(tileset_intersect(ts, accum), ZERO_TILE))) {
+		if (!tileset_empty(tileset_remove(tileset_intersect(ts[i], accum), ZERO_TILE))) {
 			fprintf(stderr, "Tilesets must not overlap.\n");
 			return (EXIT_FAILURE);
 		}
 
-		accum = tileset_union(accum, ts);
+		accum = tileset_union(accum, ts[i]);
 
-		if (!tileset_has(ts, ZERO_TILE))
+		if (!tileset_has(ts[i], ZERO_TILE))
 			pdbtype = "pdb";
 		else if (identify)
 			pdbtype = "ipdb";
@@ -364,9 +546,9 @@ main(int argc, char *argv[])
 			pdbtype = "zpdb";
 
 		if (qualities != NULL)
-			partq[i] = *get_quality(qualities, ts);
+			partq[i] = *get_quality(qualities, ts[i]);
 
-		if (heu_open(&heu, pdbdir, ts, pdbtype,
+		if (heu_open(&heu, pdbdir, ts[i], pdbtype,
 		    HEU_CREATE | HEU_NOMORPH | (quiet ? 0 : HEU_VERBOSE)) != 0) {
 			perror("heu_open");
 			return (EXIT_FAILURE);
@@ -414,10 +596,18 @@ main(int argc, char *argv[])
 		return (EXIT_FAILURE);
 	}
 
+	for (i = 0; i < 4; i++)
+		free(cohort_etas[i]);
+
 	if (!quiet)
 		fprintf(stderr, "Joining halves\n");
 
-	eta = make_eta(half_etas[0], half_etas[1], pdbdummy, bias ? no_bias : equilibrium_bias);
+	eta = make_eta(half_etas[0], half_etas[1], pdbdummy,
+	    bias ? no_bias : equilibrium_bias, relabel_parity(ts));
+	if (eta < 0.0) {
+		perror("make_eta");
+		return (EXIT_FAILURE);
+	}
 
 	if (qualities == NULL)
 		printf("%.18e %s %s %s %s\n", eta,
@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,17 +40,59 @@
 #include "catalogue.h"
 #include "fsm.h"
 #include "pdb.h"
+#include "perfcount.h"
 #include "index.h"
 #include "puzzle.h"
 #include "tileset.h"
 
 enum { CHUNK_SIZE = 1024 };
 
+/*
+ * Set when we are asked to terminate.  The searches in progress then
+ * give up and report what they have found so far, no new searches are
+ * started.
+ */
+static atomic_int interrupted = 0;
+
+/*
+ * If we receive a signal asking us to terminate, set a flag to end
+ * all searches quickly.  A second signal terminates us right away.
+ */
+static void
+interrupt_handler(int signo)
+{
+	interrupted = 1;
+	signal(signo, SIG_DFL);
+}
+
+/*
+ * A puzzle read from the input, together with the line it was read
+ * from and the predicted cost of solving it.
+ */
+struct job {
+	char *line;
+	size_t lineno;
+	double cost;
+	struct puzzle p;
+};
+
+/*
+ * The state shared by the worker threads.  Jobs are sorted by
+ * decreasing cost and handed out in order; next is the index of the
+ * next job to hand out.  If pool is not NULL, threads that find no
+ * more jobs to hand out help the remaining searches through pool.
+ * Each search is limited to node_limit nodes and time_limit seconds
+ * unless these are zero.
+ */
 struct psearch_config {
-	pthread_mutex_t lock;
-	FILE *puzzles;
+	struct job *jobs;
+	size_t n_jobs;
+	atomic_size_t next;
 	struct pdb_catalogue *cat;
 	const struct fsm *fsm;
+	struct ida_pool *pool;
+	unsigned long long node_limit;
+	double time_limit;
 	int idaflags;
 };
 
@@ -57,73 +100,181 @@ static void *
 lookup_worker(void *cfgarg)
 {
 	struct psearch_config *cfg = cfgarg;
-	struct puzzle p;
+	struct ida_config idacfg = { 0 };
+	struct ida_stats stats;
+	struct job *job;
 	struct path path;
 	unsigned long long expansions;
-	int error;
-	char linebuf[BUFSIZ], *line;
-
-	for (;;) {
-		error = pthread_mutex_lock(&cfg->lock);
-		if (error != 0) {
-			errno = error;
-			perror("pthread_mutex_lock");
-			abort();
+	size_t i;
+	char pathstr[PATH_STR_LEN];
+
+	idacfg.stats = &stats;
+	idacfg.pool = cfg->pool;
+	idacfg.node_limit = cfg->node_limit;
+	idacfg.time_limit = cfg->time_limit;
+	idacfg.cancel = &interrupted;
+
+	/* keep the helpers waiting until we are out of jobs */
+	if (cfg->pool != NULL)
+		ida_pool_enter(cfg->pool);
+
+	while (!interrupted && (i = atomic_fetch_add(&cfg->next, 1), i < cfg->n_jobs)) {
+		job = cfg->jobs + i;
+		expansions = search_ida_config(cfg->cat, cfg->fsm, &idacfg, &job->p,
+		    SEARCH_PATH_LEN, &path, NULL, NULL, cfg->idaflags);
+
+		flockfile(stdout);
+		if (stats.limited)
+			/* give the lower bound proven instead of the length */
+			printf("%zu %s >=%zu %12llu %s", job->lineno, job->line,
+			    stats.bound, expansions,
+			    interrupted ? "interrupted" : "limit");
+		else {
+			path_string(pathstr, &path);
+			printf("%zu %s %3zu %12llu %s", job->lineno, job->line,
+			    path.pathlen, expansions, pathstr);
 		}
 
-		line = fgets(linebuf, BUFSIZ, cfg->puzzles);
-		error = pthread_mutex_unlock(&cfg->lock);
-		if (error != 0) {
-			errno = error;
-			perror("pthread_mutex_unlock");
-			abort();
+		if (cfg->idaflags & IDA_PERF) {
+			printf(" ");
+			perf_print(stdout, &stats.perf, expansions);
 		}
 
-		if (line == NULL)
-			return (NULL);
+		printf("\n");
+		funlockfile(stdout);
+	}
+
+	if (cfg->pool != NULL) {
+		ida_pool_leave(cfg->pool);
+		ida_pool_help(cfg->pool);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Compare two jobs by decreasing cost, then by increasing line
+ * number.
+ */
+static int
+compare_jobs(const void *a_arg, const void *b_arg)
+{
+	const struct job *a = a_arg, *b = b_arg;
 
-		if (puzzle_parse(&p, linebuf) != 0) {
-			fprintf(stderr, "Invalid puzzle, ignoring: %s", linebuf);
+	if (a->cost != b->cost)
+		return ((a->cost < b->cost) - (a->cost > b->cost));
+	else
+		return ((a->lineno > b->lineno) - (a->lineno < b->lineno));
+}
+
+/*
+ * Read all puzzles from puzzles into cfg->jobs and sort them such that
+ * the hardest puzzles come first, so no long search is started when
+ * the other threads are about to run out of work.  A puzzle's cost is
+ * its h value.  If predict is set, the number of nodes of its second
+ * IDA* round, as predicted from its first round, is used instead,
+ * which takes more time.  Report invalid puzzles to stderr and skip
+ * them.  Stop reading once we are interrupted.
+ */
+static void
+read_jobs(struct psearch_config *cfg, FILE *puzzles, int predict)
+{
+	struct ida_config idacfg = { 0 };
+	struct ida_stats stats;
+	struct path path;
+	struct job *job;
+	size_t lineno = 0, cap = 0;
+	char linebuf[BUFSIZ];
+
+	idacfg.stats = &stats;
+	idacfg.budget = 1e-9; /* stop after the first round */
+	idacfg.cancel = &interrupted;
+
+	cfg->jobs = NULL;
+	cfg->n_jobs = 0;
+
+	while (!interrupted && fgets(linebuf, sizeof linebuf, puzzles) != NULL) {
+		lineno++;
+
+		if (cfg->n_jobs >= cap) {
+			cap = cap < CHUNK_SIZE ? CHUNK_SIZE : cap * 2;
+			cfg->jobs = realloc(cfg->jobs, cap * sizeof *cfg->jobs);
+			if (cfg->jobs == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		job = cfg->jobs + cfg->n_jobs;
+		if (puzzle_parse(&job->p, linebuf) != 0) {
+			fprintf(stderr, "Invalid puzzle on line %zu, ignoring: %s", lineno, linebuf);
 			continue;
 		}
 
-		expansions = search_ida(cfg->cat, cfg->fsm, &p, &path, NULL, NULL, cfg->idaflags);
 		linebuf[strcspn(linebuf, "\n")] = '\0';
-		flockfile(stdout);
-		printf("%s %3zu %12llu ", linebuf, path.pathlen, expansions);
-		path_string(linebuf, &path);
-		printf("%s\n", linebuf);
-		funlockfile(stdout);
+		job->line = strdup(linebuf);
+		if (job->line == NULL) {
+			perror("strdup");
+			exit(EXIT_FAILURE);
+		}
+
+		job->lineno = lineno;
+		if (predict) {
+			search_ida_config(cfg->cat, cfg->fsm, &idacfg, &job->p,
+			    SEARCH_PATH_LEN, &path, NULL, NULL, 0);
+			job->cost = path.pathlen == SEARCH_NO_PATH ? stats.predicted_nodes : 0.0;
+		} else
+			job->cost = catalogue_hval(cfg->cat, &job->p);
+
+		cfg->n_jobs++;
+	}
+
+	/* fgets() fails with EINTR if a signal interrupted it */
+	if (ferror(puzzles) && !interrupted) {
+		perror("fgets");
+		exit(EXIT_FAILURE);
 	}
+
+	qsort(cfg->jobs, cfg->n_jobs, sizeof *cfg->jobs, compare_jobs);
 }
 
 /*
  * Read puzzles from puzzles and look them up in cat, using fsm for
  * pruning.  Use up to pdb_threads job to do that.  Print solutions and
- * node counts to stdout.
+ * node counts to stdout, prefixed with the line number of the puzzle.
+ * If hybrid is set, threads running out of puzzles help with the
+ * rounds of the puzzles still being searched, so the last few hard
+ * puzzles do not leave most threads idle.  Each search gives up after
+ * node_limit nodes or time_limit seconds unless these are zero.
  */
 static void
 lookup_multiple(struct pdb_catalogue *cat, const struct fsm *fsm,
-    FILE *puzzles, int idaflags)
+    FILE *puzzles, int idaflags, int predict, int hybrid,
+    unsigned long long node_limit, double time_limit)
 {
 	struct psearch_config cfg;
+	struct ida_pool idapool;
 	pthread_t pool[PDB_MAX_JOBS];
+	size_t i;
 	int j, jobs = pdb_jobs, error;
 
-	cfg.puzzles = puzzles;
 	cfg.cat = cat;
 	cfg.fsm = fsm;
+	cfg.pool = NULL;
+	cfg.node_limit = node_limit;
+	cfg.time_limit = time_limit;
 	cfg.idaflags = idaflags;
-	error = pthread_mutex_init(&cfg.lock, NULL);
-	if (error != 0) {
-		errno = error;
-		perror("pthread_mutex_init");
-		abort();
-	}
+	read_jobs(&cfg, puzzles, predict);
+	atomic_init(&cfg.next, 0);
 
 	if (jobs == 1) {
 		lookup_worker(&cfg);
-		return;
+		goto done;
+	}
+
+	if (hybrid) {
+		ida_pool_init(&idapool, jobs);
+		cfg.pool = &idapool;
 	}
 
 	for (j = 0; j < pdb_jobs; j++) {
@@ -152,12 +303,25 @@ lookup_multiple(struct pdb_catalogue *cat, const struct fsm *fsm,
 		perror("pthread_join");
 		abort();
 	}
+
+	if (cfg.pool != NULL)
+		ida_pool_destroy(cfg.pool);
+
+done:
+	if (interrupted && cfg.next < cfg.n_jobs)
+		fprintf(stderr, "Interrupted, %zu puzzles not searched.\n",
+		    cfg.n_jobs - cfg.next);
+
+	for (i = 0; i < cfg.n_jobs; i++)
+		free(cfg.jobs[i].line);
+
+	free(cfg.jobs);
 }
 
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-Fit] [-j nproc] [-m fsmfile] [-d pdbdir] catalogue puzzles\n", argv0);
+	fprintf(stderr, "Usage: %s [-cFHipt] [-j nproc] [-m fsmfile] [-n nodes] [-s seconds] [-d pdbdir] catalogue puzzles\n", argv0);
 
 	exit(EXIT_FAILURE);
 }
@@ -168,11 +332,18 @@ main(int argc, char *argv[])
 	struct pdb_catalogue *cat;
 	const struct fsm *fsm = &fsm_simple, *newfsm;
 	FILE *puzzles, *fsmfile;
-	int optchar, catflags = 0, idaflags = 0, transpose = 0;
+	int optchar, catflags = 0, idaflags = 0, transpose = 0, predict = 0;
+	int hybrid = 0;
+	unsigned long long node_limit = 0;
+	double time_limit = 0.0;
 	char *pdbdir = NULL;
 
-	while (optchar = getopt(argc, argv, "Fd:ij:m:t"), optchar != -1)
+	while (optchar = getopt(argc, argv, "cFd:Hij:m:n:ps:t"), optchar != -1)
 		switch (optchar) {
+		case 'c':
+			idaflags |= IDA_PERF;
+			break;
+
 		case 'F':
 			idaflags |= IDA_LAST_FULL;
 			break;
@@ -181,6 +352,10 @@ main(int argc, char *argv[])
 			pdbdir = optarg;
 			break;
 
+		case 'H':
+			hybrid = 1;
+			break;
+
 		case 'i':
 			catflags |= CAT_IDENTIFY;
 			break;
@@ -214,6 +389,18 @@ main(int argc, char *argv[])
 			break;
 
 
+		case 'n':
+			node_limit = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'p':
+			predict = 1;
+			break;
+
+		case 's':
+			time_limit = strtod(optarg, NULL);
+			break;
+
 		case 't':
 			transpose = 0;
 			break;
@@ -225,6 +412,12 @@ main(int argc, char *argv[])
 	if (argc != optind + 2)
 		usage(argv[0]);
 
+	/* the events of helping threads are not counted */
+	if (hybrid && idaflags & IDA_PERF) {
+		fprintf(stderr, "Options -c and -H cannot be combined\n");
+		return (EXIT_FAILURE);
+	}
+
 	cat = catalogue_load(argv[optind], pdbdir, catflags, NULL);
 	if (cat == NULL) {
 		perror("catalogue_load");
@@ -250,7 +443,12 @@ main(int argc, char *argv[])
 	 */
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
-	lookup_multiple(cat, fsm, puzzles, idaflags);
+	/* stop gracefully, printing what we have so far */
+	signal(SIGINT, interrupt_handler);
+	signal(SIGTERM, interrupt_handler);
+
+	lookup_multiple(cat, fsm, puzzles, idaflags, predict, hybrid,
+	    node_limit, time_limit);
 
 	return (EXIT_SUCCESS);
 }
@@ -26,29 +26,38 @@
 /* pdbmatch.c -- find optimal PDB partitionings */
 
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "heuristic.h"
 #include "tileset.h"
 #include "match.h"
+#include "matchfile.h"
+#include "pdb.h"
 #include "transposition.h"
 
 #define QUALITIES_FILENAME "qualities.txt"
 
-static struct puzzle	 *read_puzzles(size_t *, FILE *);
-static unsigned char	**lookup_puzzles(const struct puzzle *, size_t, const char *);
-static void		  lookup_pattern(unsigned char **, tileset, const struct puzzle *, size_t, const char *);
-static void		  store_match_vector(const char *, unsigned char **, size_t);
-static unsigned char	**load_match_vector(const char *, size_t);
-static void		  find_matches(const struct quality[MATCH_SIZE], struct match *, const struct puzzle *, unsigned char **, size_t);
-static void		  print_matches(struct match *, const struct puzzle *, size_t);
+struct lookup_config;
+
+static struct puzzle	*read_puzzles(size_t *, FILE *);
+static void		 lookup_puzzles(struct match_file *, const struct puzzle *, const char *);
+static void		*lookup_loader(void *);
+static void		*lookup_evaluator(void *);
+static void		 lookup_sync(struct lookup_config *);
+static void		 lookup_pattern(struct match_file *, struct heuristic *, const struct puzzle *);
+static void		 find_matches(const struct quality[MATCH_SIZE], struct match *, const struct match_file *);
+static void		 print_matches(struct match *, const struct puzzle *, size_t);
 
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-r|-d pdbdir] [-m matchfile] [puzzles]\n", argv0);
+	fprintf(stderr, "Usage: %s [-r|-d pdbdir] [-j nproc] [-m matchfile] [puzzles]\n", argv0);
 
 	exit(EXIT_FAILURE);
 }
@@ -60,17 +69,27 @@ main(int argc, char *argv[])
 	struct puzzle *puzzles;
 	struct match *matches;
 	struct quality *qualities;
+	struct match_file mf;
 	size_t n_puzzle;
 	int optchar, read_matches = 0;
 	char *pdbdir = NULL, *matchfile = NULL, pathbuf[PATH_MAX];
-	unsigned char **vs;
 
-	while (optchar = getopt(argc, argv, "d:m:r"), optchar != -1)
+	while (optchar = getopt(argc, argv, "d:j:m:r"), optchar != -1)
 		switch (optchar) {
 		case 'd':
 			pdbdir = optarg;
 			break;
 
+		case 'j':
+			pdb_jobs = atoi(optarg);
+			if (pdb_jobs < 1 || pdb_jobs > PDB_MAX_JOBS) {
+				fprintf(stderr, "Number of threads must be between 1 and %d\n",
+				    PDB_MAX_JOBS);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
 		case 'm':
 			matchfile = optarg;
 			break;
@@ -110,18 +129,28 @@ main(int argc, char *argv[])
 		return (EXIT_FAILURE);
 	}
 
-	if (!read_matches) {
-		if (pdbdir == NULL)
-			usage(argv[0]);
+	if (read_matches && matchfile == NULL)
+		usage(argv[0]);
+
+	if (matchfile != NULL)
+		fprintf(stderr, "Using match file %s\n", matchfile);
+
+	if (matchfile_open(&mf, matchfile, puzzles, n_puzzle,
+	    read_matches ? 0 : MATCHFILE_CREATE) != 0) {
+		perror(matchfile != NULL ? matchfile : "matchfile_open");
+		return (EXIT_FAILURE);
+	}
+
+	if (!matchfile_complete(&mf)) {
+		if (read_matches) {
+			fprintf(stderr, "%s: match file incomplete\n", matchfile);
+			return (EXIT_FAILURE);
+		}
 
-		vs = lookup_puzzles(puzzles, n_puzzle, pdbdir);
-		if (matchfile != NULL)
-			store_match_vector(matchfile, vs, n_puzzle);
-	} else {
-		if (matchfile == NULL)
+		if (pdbdir == NULL)
 			usage(argv[0]);
 
-		vs = load_match_vector(matchfile, n_puzzle);
+		lookup_puzzles(&mf, puzzles, pdbdir);
 	}
 
 	snprintf(pathbuf, sizeof pathbuf, "%s/%s", pdbdir, QUALITIES_FILENAME);
@@ -135,8 +164,9 @@ main(int argc, char *argv[])
 		}
 	}
 
-	find_matches(qualities, matches, puzzles, vs, n_puzzle);
+	find_matches(qualities, matches, &mf);
 	print_matches(matches, puzzles, n_puzzle);
+	matchfile_close(&mf);
 
 	return (EXIT_SUCCESS);
 }
@@ -185,149 +215,283 @@ read_puzzles(size_t *n_puzzle, FILE *puzzlefile)
 	return (puzzles);
 }
 
-static unsigned char **
-lookup_puzzles(const struct puzzle *puzzles, size_t n_puzzles, const char *pdbdir)
+/*
+ * lookup_puzzles() overlaps loading PDBs with evaluating them.  Loader
+ * threads claim tile sets through next_rank, open the corresponding
+ * heuristics, and place them into the ring buffer queue.  Evaluator
+ * threads take heuristics out of the queue, look up all puzzles in
+ * them, and release them.  The queue holds at most queue_len entries,
+ * so at most pdb_jobs heuristics are being loaded, queue_len are
+ * waiting, and pdb_jobs are being evaluated at any time.  Tile sets
+ * already marked as done in the match file are skipped.  All members
+ * but the first four are protected by lock, as is the done map of mf.
+ *
+ * Writing back the match file is expensive as every PDB touches every
+ * match vector.  Evaluated tile sets are thus collected in pending and
+ * marked as done in batches, each after one matchfile_sync(), once
+ * SYNC_BATCH tile sets are pending or SYNC_INTERVAL seconds have
+ * passed since the last write back.  An interrupted run loses at most
+ * that much work.
+ */
+enum {
+	SYNC_BATCH = 64,
+	SYNC_INTERVAL = 300, /* seconds */
+};
+
+struct lookup_config {
+	struct match_file *mf;
+	const struct puzzle *puzzles;
+	const char *pdbdir;
+	size_t queue_len;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_full, not_empty;
+	size_t next_rank, head, len;
+	size_t n_pending;
+	time_t last_sync;
+	int loaders_running, syncing;
+	struct heuristic queue[PDB_MAX_JOBS];
+	tileset pending[MATCH_SIZE];
+};
+
+static void
+lookup_puzzles(struct match_file *mf, const struct puzzle *puzzles, const char *pdbdir)
 {
-	size_t i;
-	unsigned char **vs;
+	struct lookup_config *cfg;
+	pthread_t loaders[PDB_MAX_JOBS], evaluators[PDB_MAX_JOBS];
+	int j, error;
 
-	vs = malloc(n_puzzles * sizeof *vs);
-	if (vs == NULL) {
+	tileset_unrank_init(6);
+
+	cfg = malloc(sizeof *cfg);
+	if (cfg == NULL) {
 		perror("malloc");
 		exit(EXIT_FAILURE);
 	}
 
-	for (i = 0; i < n_puzzles; i++) {
-		vs[i] = matchv_allocate();
-		if (vs[i] == NULL) {
-			perror("matchv_allocate");
+	cfg->mf = mf;
+	cfg->puzzles = puzzles;
+	cfg->pdbdir = pdbdir;
+	cfg->queue_len = pdb_jobs;
+	cfg->next_rank = 0;
+	cfg->head = 0;
+	cfg->len = 0;
+	cfg->n_pending = 0;
+	cfg->last_sync = time(NULL);
+	cfg->loaders_running = pdb_jobs;
+	cfg->syncing = 0;
+
+	if ((error = pthread_mutex_init(&cfg->lock, NULL)) != 0
+	    || (error = pthread_cond_init(&cfg->not_full, NULL)) != 0
+	    || (error = pthread_cond_init(&cfg->not_empty, NULL)) != 0) {
+		errno = error;
+		perror("pthread_mutex_init");
+		exit(EXIT_FAILURE);
+	}
+
+	for (j = 0; j < pdb_jobs; j++) {
+		error = pthread_create(loaders + j, NULL, lookup_loader, cfg);
+		if (error == 0)
+			error = pthread_create(evaluators + j, NULL, lookup_evaluator, cfg);
+
+		if (error != 0) {
+			errno = error;
+			perror("pthread_create");
 			exit(EXIT_FAILURE);
 		}
 	}
 
-	tileset_unrank_init(6);
+	for (j = 0; j < pdb_jobs; j++) {
+		error = pthread_join(loaders[j], NULL);
+		if (error == 0)
+			error = pthread_join(evaluators[j], NULL);
 
-	for (i = 0; i < MATCH_SIZE; i++) {
-		lookup_pattern(vs, tileset_unrank(6, (tsrank)i) << 1,
-		    puzzles, n_puzzles, pdbdir);
+		if (error != 0) {
+			errno = error;
+			perror("pthread_join");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	return (vs);
+	assert(cfg->len == 0);
+	pthread_mutex_lock(&cfg->lock);
+	if (cfg->n_pending > 0)
+		lookup_sync(cfg);
+
+	pthread_mutex_unlock(&cfg->lock);
+
+	pthread_cond_destroy(&cfg->not_empty);
+	pthread_cond_destroy(&cfg->not_full);
+	pthread_mutex_destroy(&cfg->lock);
+	free(cfg);
 }
 
-static void
-lookup_pattern(unsigned char **vs, tileset ts, const struct puzzle *puzzles,
-    size_t n_puzzle, const char *pdbdir)
+/*
+ * Open the heuristics for all canonical tile sets not yet claimed by
+ * another loader and enqueue them for evaluation.
+ */
+static void *
+lookup_loader(void *cfgarg)
 {
-	struct heuristic heu, morphheu;
-	size_t j;
-	unsigned i;
+	struct lookup_config *cfg = cfgarg;
+	struct heuristic heu;
+	size_t rank;
+	tileset ts;
+	int done;
+
+	for (;;) {
+		pthread_mutex_lock(&cfg->lock);
+		rank = cfg->next_rank++;
+		done = rank < MATCH_SIZE && cfg->mf->done[rank];
+		pthread_mutex_unlock(&cfg->lock);
+
+		if (rank >= MATCH_SIZE)
+			break;
+
+		ts = tileset_add(tileset_unrank(6, (tsrank)rank) << 1, ZERO_TILE);
+		if (canonical_automorphism(ts) != 0 || done)
+			continue;
 
-	assert(tileset_count(ts) == 6);
-	ts = tileset_add(ts, ZERO_TILE);
+		if (heu_open(&heu, cfg->pdbdir, ts, "zbpdb.zst",
+		    HEU_NOMORPH | HEU_SIMILAR | HEU_VERBOSE) != 0) {
+			perror("heu_open");
+			exit(EXIT_FAILURE);
+		}
 
-	if (canonical_automorphism(ts) != 0)
-		return;
+		pthread_mutex_lock(&cfg->lock);
+		while (cfg->len == cfg->queue_len)
+			pthread_cond_wait(&cfg->not_full, &cfg->lock);
 
-	if (heu_open(&heu, pdbdir, ts, "zbpdb.zst",
-	    HEU_NOMORPH | HEU_SIMILAR | HEU_VERBOSE) != 0) {
-		perror("heu_open");
-		exit(EXIT_FAILURE);
+		cfg->queue[(cfg->head + cfg->len++) % cfg->queue_len] = heu;
+		pthread_cond_signal(&cfg->not_empty);
+		pthread_mutex_unlock(&cfg->lock);
 	}
 
-	for (i = 0; i < AUTOMORPHISM_COUNT; i++) {
-		if (!is_admissible_morphism(ts, i))
-			continue;
+	/* wake up the evaluators so they notice that we are done */
+	pthread_mutex_lock(&cfg->lock);
+	if (--cfg->loaders_running == 0)
+		pthread_cond_broadcast(&cfg->not_empty);
 
-		heu_morph(&morphheu, &heu, i);
-		for (j = 0; j < n_puzzle; j++)
-			match_amend(vs[j], puzzles + j, &morphheu);
-	}
+	pthread_mutex_unlock(&cfg->lock);
 
-	heu_free(&heu);
+	return (NULL);
 }
 
-static void
-store_match_vector(const char *matchfile, unsigned char **vs, size_t n_puzzle)
+/*
+ * Take heuristics out of the queue and look up all puzzles in them
+ * until the queue is empty and all loaders have finished.  The entries
+ * for a heuristic are marked as done only once the match vectors have
+ * been written back by lookup_sync(), so an interrupted run never
+ * leaves an entry marked as done that has not been filled in.
+ */
+static void *
+lookup_evaluator(void *cfgarg)
 {
-	FILE *matchf;
-	size_t i, count;
+	struct lookup_config *cfg = cfgarg;
+	struct heuristic heu;
 
-	fprintf(stderr, "Storing match vector to file %s\n", matchfile);
+	for (;;) {
+		pthread_mutex_lock(&cfg->lock);
+		while (cfg->len == 0 && cfg->loaders_running > 0)
+			pthread_cond_wait(&cfg->not_empty, &cfg->lock);
 
-	matchf = fopen(matchfile, "wb");
-	if (matchf == NULL) {
-		perror(matchfile);
-		exit(EXIT_FAILURE);
-	}
-
-	for (i = 0; i < n_puzzle; i++) {
-		count = fwrite(vs[i], 1, MATCH_SIZE, matchf);
-		if (count != MATCH_SIZE) {
-			perror(matchfile);
-			exit(EXIT_FAILURE);
+		if (cfg->len == 0) {
+			pthread_mutex_unlock(&cfg->lock);
+			break;
 		}
+
+		heu = cfg->queue[cfg->head];
+		cfg->head = (cfg->head + 1) % cfg->queue_len;
+		cfg->len--;
+		pthread_cond_signal(&cfg->not_full);
+		pthread_mutex_unlock(&cfg->lock);
+
+		lookup_pattern(cfg->mf, &heu, cfg->puzzles);
+
+		pthread_mutex_lock(&cfg->lock);
+		cfg->pending[cfg->n_pending++] = heu.ts;
+		if (!cfg->syncing && (cfg->n_pending >= SYNC_BATCH
+		    || time(NULL) - cfg->last_sync >= SYNC_INTERVAL))
+			lookup_sync(cfg);
+
+		pthread_mutex_unlock(&cfg->lock);
+
+		heu_free(&heu);
 	}
 
-	fclose(matchf);
+	return (NULL);
 }
 
-static unsigned char **
-load_match_vector(const char *matchfile, size_t n_puzzle)
+/*
+ * Write back the match file and mark the tile sets pending at the time
+ * of the call as done.  Must be called with cfg->lock held, which is
+ * released while the match file is written back.  Tile sets added to
+ * pending in the mean time remain pending.
+ */
+static void
+lookup_sync(struct lookup_config *cfg)
 {
-	FILE *matchf;
-	size_t count, i;
-	unsigned char **vs;
+	size_t j, n = cfg->n_pending;
+	unsigned i;
+	tileset ts;
 
-	vs = malloc(n_puzzle * sizeof *vs);
-	if (vs == NULL) {
-		perror("malloc");
-		exit(EXIT_FAILURE);
-	}
+	cfg->syncing = 1;
+	pthread_mutex_unlock(&cfg->lock);
 
-	fprintf(stderr, "Loading match vector from file %s\n", matchfile);
-	matchf = fopen(matchfile, "rb");
-	if (matchf == NULL) {
-		perror(matchfile);
+	if (matchfile_sync(cfg->mf) != 0) {
+		perror("matchfile_sync");
 		exit(EXIT_FAILURE);
 	}
 
-	for (i = 0; i < n_puzzle; i++) {
-		vs[i] = matchv_allocate();
-		if (vs[i] == NULL) {
-			perror("matchv_allocate");
-			exit(EXIT_FAILURE);
-		}
+	pthread_mutex_lock(&cfg->lock);
+	for (j = 0; j < n; j++) {
+		ts = tileset_add(cfg->pending[j], ZERO_TILE);
+		for (i = 0; i < AUTOMORPHISM_COUNT; i++)
+			if (is_admissible_morphism(ts, i))
+				cfg->mf->done[tileset_ranknz(tileset_morph(cfg->pending[j], i))] = 1;
+	}
 
-		count = fread(vs[i], 1, MATCH_SIZE, matchf);
-		if (count != MATCH_SIZE) {
-			if (ferror(matchf))
-				perror(matchfile);
-			else
-				fprintf(stderr, "%s: unexpected end of file\n", matchfile);
+	memmove(cfg->pending, cfg->pending + n,
+	    (cfg->n_pending - n) * sizeof *cfg->pending);
+	cfg->n_pending -= n;
+	cfg->last_sync = time(NULL);
+	cfg->syncing = 0;
+}
 
-			exit(EXIT_FAILURE);
-		}
-	}
+/*
+ * Look up puzzles in all admissible morphisms of heu and store the
+ * results to mf.
+ */
+static void
+lookup_pattern(struct match_file *mf, struct heuristic *heu,
+    const struct puzzle *puzzles)
+{
+	struct heuristic morphheu;
+	size_t j;
+	unsigned i;
+	tileset ts = tileset_add(heu->ts, ZERO_TILE);
 
-	fclose(matchf);
+	for (i = 0; i < AUTOMORPHISM_COUNT; i++) {
+		if (!is_admissible_morphism(ts, i))
+			continue;
 
-	return (vs);
+		heu_morph(&morphheu, heu, i);
+		for (j = 0; j < mf->n_puzzle; j++)
+			match_amend(matchfile_vector(mf, j), puzzles + j, &morphheu);
+	}
 }
 
 static void
 find_matches(const struct quality qualities[MATCH_SIZE],
-    struct match *matches, const struct puzzle *puzzles,
-    unsigned char **vs, size_t n_puzzle)
+    struct match *matches, const struct match_file *mf)
 {
 	size_t i;
 
+	/* match_find_best() distributes each puzzle over pdb_jobs threads */
+	for (i = 0; i < mf->n_puzzle; i++) {
+		assert(match_all_filled_in(matchfile_vector(mf, i)));
 
-
-	for (i = 0; i < n_puzzle; i++) {
-		assert(match_all_filled_in(vs[i]));
-
-		if (match_find_best(matches + i, vs[i], qualities) == 0) {
+		if (match_find_best(matches + i, matchfile_vector(mf, i), qualities) == 0) {
 			perror("match_find_best");
 			exit(EXIT_FAILURE);
 		}
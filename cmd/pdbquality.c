@@ -46,6 +46,7 @@ main(int argc, char *argv[])
 {
 	struct patterndb *pdb;
 	FILE *pdbfile;
+	double eta, h_average;
 	tileset ts = DEFAULT_TILESET;
 	int optchar, verbose = 0, jobs = pdb_jobs;
 	char tsstr[TILESET_LIST_LEN];
@@ -111,8 +112,9 @@ main(int argc, char *argv[])
 		usage(argv[0]);
 	}
 
+	pdb_quality(pdb, &eta, &h_average);
 	tileset_list_string(tsstr, ts);
-	printf("%.18f %.18e %s\n", pdb_h_average(pdb), pdb_eta(pdb), tsstr);
+	printf("%.18f %.18e %s\n", h_average, eta, tsstr);
 
 	return (EXIT_SUCCESS);
 }
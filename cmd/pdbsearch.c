@@ -37,6 +37,8 @@
 #include "catalogue.h"
 #include "fsm.h"
 #include "pdb.h"
+#include "perimeter.h"
+#include "ttable.h"
 #include "index.h"
 #include "puzzle.h"
 #include "tileset.h"
@@ -46,24 +48,95 @@ enum { CHUNK_SIZE = 1024 };
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-Fit] [-j nproc] [-m fsmfile] [-d pdbdir] catalogue\n", argv0);
+	fprintf(stderr, "Usage: %s [-bcFiot] [-B budget] [-e epsilon] [-j nproc] [-m fsmfile] [-P radius] [-p perimfile] [-T megabytes] [-d pdbdir] catalogue\n", argv0);
 
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Load a perimeter from perimfile if it is not NULL.  If perimfile is
+ * NULL or does not exist yet, generate a perimeter of the given radius
+ * instead and store it to perimfile if it is not NULL.
+ */
+static struct perimeter *
+open_perimeter(const char *perimfile, int radius)
+{
+	struct perimeter *per;
+	FILE *f = NULL;
+
+	if (perimfile != NULL) {
+		f = fopen(perimfile, "rb");
+		if (f != NULL) {
+			fprintf(stderr, "Loading perimeter file %s\n", perimfile);
+			per = perimeter_load(f);
+			if (per == NULL) {
+				perror(perimfile);
+				exit(EXIT_FAILURE);
+			}
+
+			fclose(f);
+			return (per);
+		}
+
+		if (errno != ENOENT || radius < 0) {
+			perror(perimfile);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fprintf(stderr, "Generating perimeter of radius %d\n", radius);
+	per = perimeter_generate(radius, stderr);
+	if (per == NULL) {
+		perror("perimeter_generate");
+		exit(EXIT_FAILURE);
+	}
+
+	if (perimfile == NULL)
+		return (per);
+
+	fprintf(stderr, "Writing perimeter to file %s\n", perimfile);
+	f = fopen(perimfile, "wb");
+	if (f == NULL || perimeter_store(f, per) != 0) {
+		perror(perimfile);
+		fprintf(stderr, "Proceeding anyway...\n");
+	}
+
+	if (f != NULL)
+		fclose(f);
+
+	return (per);
+}
+
 extern int
 main(int argc, char *argv[])
 {
 	const struct fsm *fsm = &fsm_simple;
 	struct pdb_catalogue *cat;
+	struct ida_config idacfg = { 0 };
+	struct ida_stats stats;
 	struct path path;
 	struct puzzle p;
 	FILE *fsmfile;
-	int optchar, catflags = 0, idaflags = IDA_VERBOSE, transpose = 0;
-	char linebuf[1024], pathstr[PATH_STR_LEN], *pdbdir = NULL;
+	double epsilon = -1.0;
+	int optchar, catflags = 0, idaflags = IDA_VERBOSE, transpose = 0, radius = -1,
+	    bidir = 0;
+	char linebuf[1024], pathstr[PATH_STR_LEN], *pdbdir = NULL, *perimfile = NULL;
 
-	while (optchar = getopt(argc, argv, "Fd:ij:m:t"), optchar != -1)
+	while (optchar = getopt(argc, argv, "B:bcFd:e:ij:m:oP:p:T:t"), optchar != -1)
 		switch (optchar) {
+		case 'B':
+			idacfg.budget = strtod(optarg, NULL);
+			idacfg.stats = &stats;
+			break;
+
+		case 'b':
+			bidir = 1;
+			break;
+
+		case 'c':
+			idaflags |= IDA_PERF;
+			break;
+
 		case 'F':
 			idaflags |= IDA_LAST_FULL;
 			break;
@@ -72,6 +145,15 @@ main(int argc, char *argv[])
 			pdbdir = optarg;
 			break;
 
+		case 'e':
+			epsilon = strtod(optarg, NULL);
+			if (epsilon < 0.0) {
+				fprintf(stderr, "Epsilon must not be negative\n");
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
 		case 'i':
 			catflags |= CAT_IDENTIFY;
 			break;
@@ -103,6 +185,33 @@ main(int argc, char *argv[])
 			fclose(fsmfile);
 			break;
 
+		case 'o':
+			idaflags |= IDA_ORDER;
+			break;
+
+		case 'P':
+			radius = atoi(optarg);
+			if (radius < 0 || radius > PERIMETER_MAX_RADIUS) {
+				fprintf(stderr, "Perimeter radius must be between 0 and %d\n",
+				    PERIMETER_MAX_RADIUS);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
+		case 'p':
+			perimfile = optarg;
+			break;
+
+		case 'T':
+			idacfg.ttable = ttable_create(strtoull(optarg, NULL, 0) << 20);
+			if (idacfg.ttable == NULL) {
+				perror("ttable_create");
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
 		case 't':
 			transpose = 1;
 			break;
@@ -125,6 +234,9 @@ main(int argc, char *argv[])
 		fprintf(stderr, "Proceeding anyway...\n");
 	}
 
+	if (perimfile != NULL || radius >= 0)
+		idacfg.perimeter = open_perimeter(perimfile, radius);
+
 	for (;;) {
 		printf("Enter instance to solve:\n");
 		if (fgets(linebuf, sizeof linebuf, stdin) == NULL)
@@ -143,7 +255,22 @@ main(int argc, char *argv[])
 		}
 
 		fprintf(stderr, "Solving puzzle...\n");
-		search_ida(cat, fsm, &p, &path, NULL, NULL, idaflags);
+		if (epsilon >= 0.0)
+			search_ida_weighted(cat, fsm, epsilon, &p, SEARCH_PATH_LEN, &path, NULL, idaflags);
+		else if (bidir)
+			search_bidir(cat, fsm, &p, SEARCH_PATH_LEN, &path, NULL, NULL, idaflags);
+		else
+			search_ida_config(cat, fsm, &idacfg, &p, SEARCH_PATH_LEN, &path, NULL, NULL, idaflags);
+
+		if (path.pathlen == SEARCH_NO_PATH) {
+			if (idacfg.stats != NULL && stats.out_of_budget)
+				printf("Out of budget, solution has at least %zu moves.\n", stats.bound);
+			else
+				printf("No solution found.\n");
+
+			continue;
+		}
+
 		path_string(pathstr, &path);
 		printf("Solution found: %s\n", pathstr);
 	}
@@ -27,16 +27,19 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "catalogue.h"
 #include "statistics.h"
 #include "random.h"
 #include "search.h"
 #include "fsm.h"
+#include "samplefile.h"
 
 /* flags for output control */
 enum {
@@ -45,6 +48,14 @@ enum {
 	TRANSPOSE = 1 << 2,
 };
 
+enum {
+	/* number of rest samples drawn from one random stream */
+	REST_CHUNK = 1024,
+};
+
+/* the base b of eta, see -B */
+static double base = B;
+
 struct stratum {
 	long long n_samples;	/* actual number of samples */
 	double eta;		/* eta value determined for the stratum */
@@ -53,84 +64,146 @@ struct stratum {
 };
 
 /*
- * Compute the h value of p as given by cat.  If flags & TRANSPOSE,
- * compute the h value on both the puzzle and its transposition and
- * return the maximum.  This alters the content of p.
+ * Compute b^-h(v) for the n puzzle configurations ps with the
+ * heuristic given by cat and store the results to powh.  If flags &
+ * TRANSPOSE, compute the h value on both the puzzle and its
+ * transposition and use the maximum.  This alters the content of ps.
  */
-static int
-get_hval(struct puzzle *p, struct pdb_catalogue *cat, int flags)
+static void
+pow_hs(double *powh, struct puzzle *ps, size_t n, struct pdb_catalogue *cat, int flags)
+{
+	unsigned h1[CATALOGUE_BATCH_LEN], h2[CATALOGUE_BATCH_LEN];
+	size_t i, j, len;
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < CATALOGUE_BATCH_LEN ? n - i : CATALOGUE_BATCH_LEN;
+		catalogue_hvals(h1, cat, ps + i, len);
+		if (flags & TRANSPOSE) {
+			for (j = 0; j < len; j++)
+				transpose(ps + i + j);
+
+			catalogue_hvals(h2, cat, ps + i, len);
+			for (j = 0; j < len; j++)
+				if (h2[j] > h1[j])
+					h1[j] = h2[j];
+		}
+
+		for (j = 0; j < len; j++)
+			powh[i + j] = pow(base, -(double)h1[j]);
+	}
+}
+
+/*
+ * Run worker on n_jobs job descriptions of jobsize bytes each stored
+ * in the array jobs, using one thread per job.  If only one job is
+ * requested, run it on the calling thread for easier debugging.
+ */
+static void
+run_jobs(void *(*worker)(void *), void *jobs, size_t jobsize, int n_jobs)
 {
-	int h1, h2;
+	pthread_t pool[PDB_MAX_JOBS];
+	int i, error;
+
+	if (n_jobs == 1) {
+		worker(jobs);
+		return;
+	}
 
-	h1 = catalogue_hval(cat, p);
-	if (flags & TRANSPOSE) {
-		transpose(p);
-		h2 = catalogue_hval(cat, p);
+	for (i = 0; i < n_jobs; i++) {
+		error = pthread_create(pool + i, NULL, worker, (char *)jobs + i * jobsize);
+		if (error != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(error));
+			exit(EXIT_FAILURE);
+		}
+	}
 
-		return (h1 > h2 ? h1 : h2);
-	} else
-		return (h1);
+	for (i = 0; i < n_jobs; i++) {
+		error = pthread_join(pool[i], NULL);
+		if (error != 0) {
+			fprintf(stderr, "pthread_join: %s\n", strerror(error));
+			exit(EXIT_FAILURE);
+		}
+	}
 }
 
 /*
- * Compute b^-h(v) for a given puzzle configuration and a given heuristic.
+ * Configuration for evaluating a sphere sample file.  Each thread
+ * merges into its own accumulator so the results can be merged in a
+ * deterministic order.  The accumulators share cache lines, so each
+ * chunk is accumulated locally and merged into accs[job] once.
  */
-static double
-pow_h(struct puzzle *p, struct pdb_catalogue *cat, int flags)
+struct sphere_config {
+	struct samplefile_config sfcfg;
+	struct pdb_catalogue *cat;
+	double size;		/* sphere size */
+	int flags;
+	struct accumulator accs[PDB_MAX_JOBS];
+};
+
+/*
+ * Evaluate n samples from records.  Each sample contributes its b^-h
+ * with weight 1/(size * p).
+ */
+static void
+sphere_worker(void *cfgarg, int job, const void *records, size_t n)
 {
-	return (pow(B, -(double)get_hval(p, cat, flags)));
+	struct sphere_config *cfg = cfgarg;
+	const struct sample *samples = records;
+	struct puzzle ps[SAMPLEFILE_CHUNK];
+	struct accumulator acc;
+	double powh[SAMPLEFILE_CHUNK];
+	size_t i;
+
+	unpack_puzzles(ps, records, sizeof *samples, n);
+	pow_hs(powh, ps, n, cfg->cat, cfg->flags);
+	accum_init(&acc);
+	for (i = 0; i < n; i++)
+		accum_add(&acc, powh[i], 1.0 / (cfg->size * samples[i].p));
+
+	accum_merge(&cfg->accs[job], &acc);
 }
 
 /*
- * Taking samples from filename, sample a stratum using up to
- * max_samples samples.  Less are used if the sample file has less
- * entries.  If verbose is set, print a statistical report to
- * stderr.  Save the results of the sample to str.  Return -1 on
- * error, 0 on success.
+ * Taking samples from the sample file sf, sample a stratum using up
+ * to max_samples samples.  Less are used if the sample file has less
+ * entries.  The sample file is split into pdb_jobs ranges of records
+ * evaluated in parallel.  If verbose is set, print a statistical
+ * report to stderr.  Save the results of the sample to str.  Return
+ * -1 on error, 0 on success.
  */
 static int
-sample_sphere(int d, struct stratum *str, struct pdb_catalogue *cat, FILE *samplefile,
-    long long max_samples, int flags)
+sample_sphere(int d, struct stratum *str, struct pdb_catalogue *cat,
+    struct sample_file *sf, long long max_samples, int flags)
 {
-	struct puzzle p;
-	struct sample s;
-	long long i;
-	size_t count;
-	double diff, accum = 0.0, (*observations)[2];
-
-	observations = malloc(max_samples * sizeof *observations);
-	if (observations == NULL)
-		return (-1);
-
-	/* first pass: compute expected value */
-	i = 0;
-	while (i < max_samples &&
-	    (count = fread(&s, sizeof s, 1, samplefile), count == 1)) {
-		unpack_puzzle(&p, &s.cp);
-		observations[i][0] = pow_h(&p, cat, flags);
-		observations[i][1] = s.p;
-		accum += observations[i][0] / observations[i][1];
-		i++;
-	}
-
-	if (ferror(samplefile)) {
-		free(observations);
-		return (-1);
-	}
-
-	str->n_samples = i;
-	str->eta = accum / (sphere_sizes[d] * str->n_samples);
-
-	/* second pass: compute variance */
-	accum = 0.0;
-	i = 0;
-	for (i = 0; i < str->n_samples; i++) {
-		diff = str->eta - observations[i][0];
-		accum += diff * diff / (sphere_sizes[d] * observations[i][1]);
-	}
+	struct sphere_config cfg;
+	struct accumulator acc;
+	int i;
 
-	free(observations);
-	str->var = accum / str->n_samples;
+	if (sf->n_record > (unsigned long long)max_samples)
+		sf->n_record = max_samples;
+
+	cfg.sfcfg.sf = sf;
+	cfg.sfcfg.worker = sphere_worker;
+	cfg.cat = cat;
+	cfg.size = sphere_sizes[d];
+	cfg.flags = flags;
+	for (i = 0; i < pdb_jobs; i++)
+		accum_init(&cfg.accs[i]);
+
+	samplefile_iterate_parallel(&cfg.sfcfg);
+
+	accum_init(&acc);
+	for (i = 0; i < pdb_jobs; i++)
+		accum_merge(&acc, &cfg.accs[i]);
+
+	/*
+	 * eta is the sum of all weighted observations divided by
+	 * the number of samples, which differs from the weighted
+	 * mean.  Correct the variance for this.
+	 */
+	str->n_samples = acc.n;
+	str->eta = acc.mean * acc.w / acc.n;
+	str->var = (acc.m2 + acc.w * (acc.mean - str->eta) * (acc.mean - str->eta)) / acc.n;
 	str->size = sphere_sizes[d] / CONFCOUNT;
 
 	if (flags & VERBOSE)
@@ -156,62 +229,111 @@ rest_size(int limit)
 }
 
 /*
- * generate n_samples random samples from the search space.  If VERIFY
- * is set in flags, use vcat to make sure they have a distance of more
- * than lower. If VERBOSE is set in flags, print a human-readable record
- * to stderr. Return 0 on success, -1 on error.  Store statistical data
- * to str.
+ * The share of rest samples taken by one thread.  The samples are
+ * drawn in chunks of REST_CHUNK samples, each from its own random
+ * stream.  The thread takes chunks first_chunk, first_chunk + stride,
+ * first_chunk + 2 * stride and so on, making the samples taken
+ * independent of the number of threads.
  */
-static int
-sample_rest(int lower, struct stratum *str, struct pdb_catalogue *cat,
-    struct pdb_catalogue *vcat, long long rest_samples, int flags)
+struct rest_job {
+	struct accumulator acc;
+	struct pdb_catalogue *cat, *vcat;
+	long long n_samples, rejects, first_chunk, stride;
+	int lower, flags;
+};
+
+/*
+ * Take the rest samples described by jobarg.  The jobs share cache
+ * lines, so the samples are accumulated locally and stored to the job
+ * once done.
+ */
+static void *
+rest_worker(void *jobarg)
 {
-	struct puzzle p;
-	long long i = 0, rejects = 0;
-	double accum, obs;
-	unsigned char *hvals;
+	struct rest_job *job = jobarg;
+	struct random_state rs;
+	struct accumulator acc;
+	struct puzzle ps[REST_CHUNK];
+	struct path pa;
+	double powh[REST_CHUNK];
+	long long chunk, i, n, rejects = 0;
+
+	accum_init(&acc);
+
+	for (chunk = job->first_chunk; chunk * REST_CHUNK < job->n_samples; chunk += job->stride) {
+		random_stream(&rs, chunk);
+
+		n = job->n_samples - chunk * REST_CHUNK;
+		if (n > REST_CHUNK)
+			n = REST_CHUNK;
+
+		for (i = 0; i < n; ) {
+			random_puzzle_r(&rs, ps + i);
+
+			if (job->flags & VERIFY) {
+				search_ida_bounded(job->vcat, &fsm_simple, ps + i, job->lower, &pa, NULL, NULL, 0);
+				if (pa.pathlen != SEARCH_NO_PATH) {
+					rejects++;
+					continue;
+				}
+			}
 
-	assert(rest_samples >= 0);
-	hvals = malloc(rest_samples * sizeof *hvals);
-	if (hvals == NULL)
-		return (-1);
+			i++;
+		}
 
-	/* take samples */
-	while (i < rest_samples) {
-		struct path pa;
+		pow_hs(powh, ps, n, job->cat, job->flags);
+		for (i = 0; i < n; i++)
+			accum_add(&acc, powh[i], 1.0);
+	}
 
-		random_puzzle(&p);
+	job->acc = acc;
+	job->rejects = rejects;
 
-		if (flags & VERIFY) {
-			search_ida_bounded(vcat, &fsm_simple, &p, lower, &pa, NULL, NULL, 0);
-			if (pa.pathlen != SEARCH_NO_PATH) {
-				rejects++;
-				continue;
-			}
-		}
+	return (NULL);
+}
 
-		hvals[i++] = get_hval(&p, cat, flags);
-	}
+/*
+ * generate n_samples random samples from the search space using up to
+ * pdb_jobs threads.  If VERIFY is set in flags, use vcat to make sure
+ * they have a distance of more than lower. If VERBOSE is set in flags,
+ * print a human-readable record to stderr. Return 0 on success, -1 on
+ * error.  Store statistical data to str.
+ */
+static int
+sample_rest(int lower, struct stratum *str, struct pdb_catalogue *cat,
+    struct pdb_catalogue *vcat, long long rest_samples, int flags)
+{
+	struct rest_job jobs[PDB_MAX_JOBS];
+	struct accumulator acc;
+	long long rejects = 0;
+	int i;
 
-	str->n_samples = i;
+	assert(rest_samples >= 0);
 
-	/* compute arithmetic mean */
-	accum = 0.0;
-	for (i = 0; i < rest_samples; i++)
-		accum += pow(B, -(double)hvals[i]);
+	for (i = 0; i < pdb_jobs; i++) {
+		accum_init(&jobs[i].acc);
+		jobs[i].cat = cat;
+		jobs[i].vcat = vcat;
+		jobs[i].n_samples = rest_samples;
+		jobs[i].rejects = 0;
+		jobs[i].first_chunk = i;
+		jobs[i].stride = pdb_jobs;
+		jobs[i].lower = lower;
+		jobs[i].flags = flags;
+	}
 
-	str->eta = accum / str->n_samples;
+	run_jobs(rest_worker, jobs, sizeof *jobs, pdb_jobs);
 
-	/* compute variance */
-	accum = 0.0;
-	for (i = 0; i < rest_samples; i++) {
-		obs = str->eta - pow(B, -(double)hvals[i]);
-		accum += obs * obs;
+	accum_init(&acc);
+	for (i = 0; i < pdb_jobs; i++) {
+		accum_merge(&acc, &jobs[i].acc);
+		rejects += jobs[i].rejects;
 	}
 
-	str->var = accum / str->n_samples;
+	str->n_samples = acc.n;
+	str->eta = acc.mean;
+	str->var = acc.m2 / acc.n;
 	str->size = rest_size(lower) / CONFCOUNT;
-	free(hvals);
 
 	if (flags & VERBOSE)
 		fprintf(stderr, "rest avg %#e part %#e sdev %#e samples %8lld rej %lld)\n",
@@ -258,7 +380,7 @@ join_strata(struct stratum *strata, int limit)
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-tvV] [-j nproc] [-s seed] [-n max_samples]\n"
+	fprintf(stderr, "Usage: %s [-tvV] [-B base] [-j nproc] [-s seed] [-n max_samples]\n"
 	    "    [-d pdbdir] [-c verification_catalogue] [-l limit]\n"
 	    "    [-p sample_prefix] [-r rest_samples] catalogue\n", argv0);
 	exit(EXIT_FAILURE);
@@ -269,13 +391,22 @@ main(int argc, char *argv[])
 {
 	struct pdb_catalogue *cat, *vcat;
 	struct stratum *strata;
-	FILE *samplefile;
+	struct sample_file sf;
 	long long max_samples = LLONG_MAX, rest_samples = 1000000;
 	int i, optchar, flags = 0, limit = MAX_SPHERE;
 	char *prefix = NULL, *pdbdir = NULL, *vcatname = NULL, filename[PATH_MAX];
 
-	while (optchar = getopt(argc, argv, "c:d:j:l:n:p:r:s:tvV"), optchar != -1)
+	while (optchar = getopt(argc, argv, "B:c:d:j:l:n:p:r:s:tvV"), optchar != -1)
 		switch (optchar) {
+		case 'B':
+			base = strtod(optarg, NULL);
+			if (!(base > 1.0)) {
+				fprintf(stderr, "Base must be larger than 1: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
 		case 'c':
 			vcatname = optarg;
 			break;
@@ -382,8 +513,7 @@ main(int argc, char *argv[])
 
 	for (i = 0; i <= limit; i++) {
 		snprintf(filename, sizeof filename, "%s%d.sample", prefix, i);
-		samplefile = fopen(filename, "rb");
-		if (samplefile == NULL)
+		if (samplefile_open(&sf, filename, sizeof(struct sample)) != 0)
 			/* if the sample file doesn't exist, assume we ran out of spheres */
 			if (errno == ENOENT) {
 				limit = i - 1;
@@ -393,12 +523,12 @@ main(int argc, char *argv[])
 				return (EXIT_FAILURE);
 			}
 
-		if (sample_sphere(i, strata + i, cat, samplefile, max_samples, flags) != 0) {
+		if (sample_sphere(i, strata + i, cat, &sf, max_samples, flags) != 0) {
 			perror("sample_sphere");
 			return (EXIT_FAILURE);
 		}
 
-		fclose(samplefile);
+		samplefile_close(&sf);
 	}
 
 	if (sample_rest(limit, strata + limit + 1, cat, vcat, rest_samples, flags) != 0) {
@@ -0,0 +1,756 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* solverd.c -- solve puzzles submitted over a Unix domain socket */
+
+/*
+ * This program loads a PDB catalogue and a finite state machine once
+ * and then solves puzzles for clients connecting to a Unix domain
+ * socket, saving the start-up cost of pdbsearch for every puzzle.
+ * Each line a client sends is a puzzle to solve.  The puzzles of all
+ * clients are solved by a pool of worker threads, so results are sent
+ * back in the order they are found, each tagged with the number of the
+ * line it answers, counting from 1:
+ *
+ *     line length expanded seconds path
+ *
+ * or, if the search gave up because of a node or time limit,
+ *
+ *     line >=bound expanded seconds limit
+ *
+ * where bound is a lower bound for the solution length, or, if the
+ * line could not be processed,
+ *
+ *     line error message
+ *
+ * seconds is the wall-clock time taken by the search.  Once a client
+ * hangs up, its searches are cancelled and its queued puzzles dropped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "catalogue.h"
+#include "fsm.h"
+#include "pdb.h"
+#include "puzzle.h"
+#include "search.h"
+
+/*
+ * A reply line waiting to be sent to a client.
+ */
+struct reply {
+	struct reply *next;
+	char line[];
+};
+
+/*
+ * A client connection.  Replies are queued from head to tail and sent
+ * by a writer thread of the client, so a client that does not read its
+ * replies only holds up its own writer, never the solver threads.
+ * refs counts the reader thread of the client and its jobs not yet
+ * answered.  Once it drops to zero, the writer sends the remaining
+ * replies and closes the connection.  lock protects the queue and
+ * refs, the writer waits on changed for either to change.  dead is
+ * set once the client has gone away and serves as the cancellation
+ * flag for its searches.
+ */
+struct client {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	struct reply *head, **tail;
+	int fd, refs;
+	atomic_int dead;
+};
+
+/*
+ * A puzzle to solve for client, submitted on the given line.
+ */
+struct job {
+	struct job *next;
+	struct client *client;
+	unsigned long long line;
+	struct puzzle p;
+};
+
+/*
+ * The state shared by all threads: the job queue, protected by lock,
+ * and the search parameters.  Workers wait on nonempty for jobs.
+ * Each search is limited to node_limit nodes and time_limit seconds
+ * unless these are zero.
+ */
+struct solverd_config {
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty;
+	struct job *head, **tail;
+	struct pdb_catalogue *cat;
+	const struct fsm *fsm;
+	unsigned long long node_limit;
+	double time_limit;
+	int idaflags;
+};
+
+/* how often to check if a client went away, in milliseconds */
+enum { HANGUP_POLL_INTERVAL = 200 };
+
+/*
+ * Arguments for client_reader().
+ */
+struct reader_arg {
+	struct solverd_config *cfg;
+	struct client *client;
+};
+
+static void
+lock(pthread_mutex_t *mtx)
+{
+	int error;
+
+	error = pthread_mutex_lock(mtx);
+	if (error != 0) {
+		errno = error;
+		perror("pthread_mutex_lock");
+		abort();
+	}
+}
+
+static void
+unlock(pthread_mutex_t *mtx)
+{
+	int error;
+
+	error = pthread_mutex_unlock(mtx);
+	if (error != 0) {
+		errno = error;
+		perror("pthread_mutex_unlock");
+		abort();
+	}
+}
+
+/*
+ * Drop a reference to client.  Once the last reference is gone, the
+ * writer of client closes the connection.
+ */
+static void
+client_release(struct client *client)
+{
+	lock(&client->lock);
+	if (--client->refs == 0)
+		pthread_cond_signal(&client->changed);
+	unlock(&client->lock);
+}
+
+/*
+ * Queue one reply line to be sent to client.  This does not block on
+ * the connection.  Errors are ignored: if the reply cannot be queued,
+ * there is nobody to tell.
+ */
+static void
+client_reply(struct client *client, const char *line)
+{
+	struct reply *reply;
+	size_t len;
+
+	len = strlen(line);
+	reply = malloc(sizeof *reply + len + 1);
+	if (reply == NULL) {
+		perror("malloc");
+		return;
+	}
+
+	memcpy(reply->line, line, len + 1);
+	reply->next = NULL;
+
+	lock(&client->lock);
+	*client->tail = reply;
+	client->tail = &reply->next;
+	pthread_cond_signal(&client->changed);
+	unlock(&client->lock);
+}
+
+/*
+ * Write all of buf to fd.  Return 0 on success, -1 on error.
+ */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t count;
+
+	while (len > 0) {
+		count = write(fd, buf, len);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return (-1);
+		}
+
+		buf += count;
+		len -= (size_t)count;
+	}
+
+	return (0);
+}
+
+/*
+ * Send the replies queued for a client until the last reference to it
+ * is gone, then close the connection and free the client.  If the
+ * client went away, mark it as dead, shut the connection down so its
+ * reader stops, and discard the remaining replies.
+ */
+static void *
+client_writer(void *clientarg)
+{
+	struct client *client = clientarg;
+	struct reply *reply;
+
+	for (;;) {
+		lock(&client->lock);
+		while (client->head == NULL && client->refs > 0)
+			pthread_cond_wait(&client->changed, &client->lock);
+
+		reply = client->head;
+		if (reply != NULL) {
+			client->head = reply->next;
+			if (client->head == NULL)
+				client->tail = &client->head;
+		}
+
+		unlock(&client->lock);
+
+		if (reply == NULL)
+			break;
+
+		if (!atomic_load(&client->dead)
+		    && write_all(client->fd, reply->line, strlen(reply->line)) != 0) {
+			if (errno != EPIPE && errno != ECONNRESET)
+				perror("write");
+
+			atomic_store(&client->dead, 1);
+			shutdown(client->fd, SHUT_RDWR);
+		}
+
+		free(reply);
+	}
+
+	close(client->fd);
+	pthread_cond_destroy(&client->changed);
+	pthread_mutex_destroy(&client->lock);
+	free(client);
+
+	return (NULL);
+}
+
+/*
+ * Append job to the job queue and wake up a worker.
+ */
+static void
+enqueue(struct solverd_config *cfg, struct job *job)
+{
+	job->next = NULL;
+
+	lock(&cfg->lock);
+	*cfg->tail = job;
+	cfg->tail = &job->next;
+	pthread_cond_signal(&cfg->nonempty);
+	unlock(&cfg->lock);
+}
+
+/*
+ * Remove the first job from the job queue and return it.  Wait for a
+ * job if the queue is empty.  Jobs of clients that went away are
+ * dropped.
+ */
+static struct job *
+dequeue(struct solverd_config *cfg)
+{
+	struct job *job;
+
+	for (;;) {
+		lock(&cfg->lock);
+		while (cfg->head == NULL)
+			pthread_cond_wait(&cfg->nonempty, &cfg->lock);
+
+		job = cfg->head;
+		cfg->head = job->next;
+		if (cfg->head == NULL)
+			cfg->tail = &cfg->head;
+
+		unlock(&cfg->lock);
+
+		if (!atomic_load(&job->client->dead))
+			return (job);
+
+		client_release(job->client);
+		free(job);
+	}
+}
+
+/*
+ * Solve the jobs from the job queue, one after another.
+ */
+static void *
+solve_worker(void *cfgarg)
+{
+	struct solverd_config *cfg = cfgarg;
+	struct ida_config idacfg = { 0 };
+	struct ida_stats stats;
+	struct job *job;
+	struct path path;
+	unsigned long long expansions;
+	char reply[PATH_STR_LEN + 128], pathstr[PATH_STR_LEN];
+
+	idacfg.stats = &stats;
+	idacfg.node_limit = cfg->node_limit;
+	idacfg.time_limit = cfg->time_limit;
+
+	for (;;) {
+		job = dequeue(cfg);
+
+		idacfg.cancel = &job->client->dead;
+		expansions = search_ida_config(cfg->cat, cfg->fsm, &idacfg, &job->p,
+		    SEARCH_PATH_LEN, &path, NULL, NULL, cfg->idaflags);
+		if (stats.limited)
+			/* give the lower bound proven instead of the length */
+			snprintf(reply, sizeof reply, "%llu >=%zu %llu %.3f limit\n",
+			    job->line, stats.bound, expansions, stats.seconds);
+		else {
+			path_string(pathstr, &path);
+			snprintf(reply, sizeof reply, "%llu %zu %llu %.3f %s\n",
+			    job->line, path.pathlen, expansions, stats.seconds, pathstr);
+		}
+
+		client_reply(job->client, reply);
+		client_release(job->client);
+		free(job);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Wait until all jobs of client have been answered, leaving only the
+ * reference of its reader, or until the client hangs up, which is
+ * detected on fd.  In the latter case, mark the client as dead.  A
+ * client may shut down its end of the connection after sending its
+ * puzzles and still wait for the replies, so end of file alone does
+ * not mean that it went away.
+ */
+static void
+client_linger(struct client *client, int fd)
+{
+	struct pollfd pfd;
+	int refs;
+
+	pfd.fd = fd;
+	pfd.events = 0;
+
+	for (;;) {
+		lock(&client->lock);
+		refs = client->refs;
+		unlock(&client->lock);
+
+		if (refs == 1 || atomic_load(&client->dead))
+			return;
+
+		if (poll(&pfd, 1, HANGUP_POLL_INTERVAL) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			perror("poll");
+			return;
+		}
+
+		if (pfd.revents & (POLLHUP | POLLERR)) {
+			atomic_store(&client->dead, 1);
+			return;
+		}
+	}
+}
+
+/*
+ * Read puzzles from a client and queue them for solving until the
+ * client shuts down its end of the connection.  Then wait for the
+ * client to receive its replies or to go away.
+ */
+static void *
+client_reader(void *readerarg)
+{
+	struct reader_arg *arg = readerarg;
+	struct solverd_config *cfg = arg->cfg;
+	struct client *client = arg->client;
+	struct job *job;
+	FILE *requests;
+	unsigned long long line = 0;
+	int fd, c;
+	char linebuf[BUFSIZ], reply[128];
+
+	free(arg);
+
+	/* reading through a copy of fd lets fclose() leave fd open */
+	fd = dup(client->fd);
+	requests = fd == -1 ? NULL : fdopen(fd, "r");
+	if (requests == NULL) {
+		perror("fdopen");
+		if (fd != -1)
+			close(fd);
+
+		client_release(client);
+		return (NULL);
+	}
+
+	while (fgets(linebuf, sizeof linebuf, requests) != NULL) {
+		line++;
+
+		/* reject overlong lines as a whole */
+		if (strchr(linebuf, '\n') == NULL && !feof(requests)) {
+			while (c = getc(requests), c != EOF && c != '\n')
+				;
+
+			snprintf(reply, sizeof reply, "%llu error line too long\n", line);
+			client_reply(client, reply);
+			continue;
+		}
+
+		job = malloc(sizeof *job);
+		if (job == NULL) {
+			snprintf(reply, sizeof reply, "%llu error %s\n", line, strerror(errno));
+			client_reply(client, reply);
+			continue;
+		}
+
+		if (puzzle_parse(&job->p, linebuf) != 0) {
+			snprintf(reply, sizeof reply, "%llu error invalid puzzle\n", line);
+			client_reply(client, reply);
+			free(job);
+			continue;
+		}
+
+		if (puzzle_parity(&job->p) != 0) {
+			snprintf(reply, sizeof reply, "%llu error puzzle unsolvable\n", line);
+			client_reply(client, reply);
+			free(job);
+			continue;
+		}
+
+		job->client = client;
+		job->line = line;
+
+		lock(&client->lock);
+		client->refs++;
+		unlock(&client->lock);
+
+		enqueue(cfg, job);
+	}
+
+	if (ferror(requests))
+		atomic_store(&client->dead, 1);
+	else
+		client_linger(client, fd);
+
+	fclose(requests);
+	client_release(client);
+
+	return (NULL);
+}
+
+/*
+ * If there is a stale socket at addr left behind by an earlier
+ * instance, remove it.  Return 0 on success.  If something other than
+ * a socket is at addr or another instance is still serving on it,
+ * return -1 and set errno.
+ */
+static int
+remove_stale_socket(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int sock, error;
+
+	if (lstat(addr->sun_path, &st) != 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	if (!S_ISSOCK(st.st_mode)) {
+		errno = EEXIST;
+		return (-1);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1)
+		return (-1);
+
+	if (connect(sock, (const struct sockaddr *)addr, sizeof *addr) == 0) {
+		close(sock);
+		errno = EADDRINUSE;
+		return (-1);
+	}
+
+	error = errno;
+	close(sock);
+	if (error != ECONNREFUSED && error != ENOENT) {
+		errno = error;
+		return (-1);
+	}
+
+	return (unlink(addr->sun_path) != 0 && errno != ENOENT ? -1 : 0);
+}
+
+/*
+ * Create a socket listening on path, replacing a stale socket left
+ * behind by an earlier instance.  Return the socket or -1 on error.
+ */
+static int
+open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock, error;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr.sun_path) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	strcpy(addr.sun_path, path);
+
+	if (remove_stale_socket(&addr) != 0)
+		return (-1);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1)
+		return (-1);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof addr) != 0
+	    || listen(sock, SOMAXCONN) != 0) {
+		error = errno;
+		close(sock);
+		errno = error;
+		return (-1);
+	}
+
+	return (sock);
+}
+
+/*
+ * Accept clients on sock and start a reader and a writer thread for
+ * each of them.  This function does not return.
+ */
+static void
+serve(struct solverd_config *cfg, int sock)
+{
+	struct reader_arg *arg;
+	struct client *client;
+	pthread_t reader, writer;
+	int fd, error;
+
+	for (;;) {
+		fd = accept(sock, NULL, NULL);
+		if (fd == -1) {
+			perror("accept");
+			continue;
+		}
+
+		client = malloc(sizeof *client);
+		arg = malloc(sizeof *arg);
+		if (client == NULL || arg == NULL) {
+			perror("malloc");
+			free(client);
+			free(arg);
+			close(fd);
+			continue;
+		}
+
+		pthread_mutex_init(&client->lock, NULL);
+		pthread_cond_init(&client->changed, NULL);
+		client->head = NULL;
+		client->tail = &client->head;
+		client->fd = fd;
+		client->refs = 1;
+		atomic_init(&client->dead, 0);
+		arg->cfg = cfg;
+		arg->client = client;
+
+		error = pthread_create(&writer, NULL, client_writer, client);
+		if (error != 0) {
+			errno = error;
+			perror("pthread_create");
+			pthread_cond_destroy(&client->changed);
+			pthread_mutex_destroy(&client->lock);
+			free(client);
+			free(arg);
+			close(fd);
+			continue;
+		}
+
+		pthread_detach(writer);
+
+		error = pthread_create(&reader, NULL, client_reader, arg);
+		if (error != 0) {
+			errno = error;
+			perror("pthread_create");
+			free(arg);
+			client_release(client);
+			continue;
+		}
+
+		pthread_detach(reader);
+	}
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-it] [-j nproc] [-m fsmfile] [-n nodes] [-s seconds]\n"
+	    "    [-d pdbdir] catalogue socket\n", argv0);
+
+	exit(EXIT_FAILURE);
+}
+
+extern int
+main(int argc, char *argv[])
+{
+	struct solverd_config cfg;
+	pthread_t pool[PDB_MAX_JOBS];
+	FILE *fsmfile;
+	int optchar, catflags = 0, transpose = 0, sock, j, error;
+	char *pdbdir = NULL;
+
+	cfg.fsm = &fsm_simple;
+	cfg.node_limit = 0;
+	cfg.time_limit = 0.0;
+	cfg.idaflags = 0;
+	cfg.head = NULL;
+	cfg.tail = &cfg.head;
+
+	while (optchar = getopt(argc, argv, "d:ij:m:n:s:t"), optchar != -1)
+		switch (optchar) {
+		case 'd':
+			pdbdir = optarg;
+			break;
+
+		case 'i':
+			catflags |= CAT_IDENTIFY;
+			break;
+
+		case 'j':
+			pdb_jobs = atoi(optarg);
+			if (pdb_jobs < 1 || pdb_jobs > PDB_MAX_JOBS) {
+				fprintf(stderr, "Number of threads must be between 1 and %d\n",
+				    PDB_MAX_JOBS);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
+		case 'm':
+			fprintf(stderr, "Loading finite state machine file %s\n", optarg);
+			fsmfile = fopen(optarg, "rb");
+			if (fsmfile == NULL) {
+				perror(optarg);
+				return (EXIT_FAILURE);
+			}
+
+			cfg.fsm = fsm_load(fsmfile);
+			if (cfg.fsm == NULL) {
+				perror("fsm_load");
+				return (EXIT_FAILURE);
+			}
+
+			fclose(fsmfile);
+			break;
+
+		case 'n':
+			cfg.node_limit = strtoull(optarg, NULL, 0);
+			break;
+
+		case 's':
+			cfg.time_limit = strtod(optarg, NULL);
+			break;
+
+		case 't':
+			transpose = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+
+	if (argc != optind + 2)
+		usage(argv[0]);
+
+	cfg.cat = catalogue_load(argv[optind], pdbdir, catflags, stderr);
+	if (cfg.cat == NULL) {
+		perror("catalogue_load");
+		return (EXIT_FAILURE);
+	}
+
+	if (transpose && catalogue_add_transpositions(cfg.cat) != 0) {
+		perror("catalogue_add_transpositions");
+		fprintf(stderr, "Proceeding anyway...\n");
+	}
+
+	sock = open_socket(argv[optind + 1]);
+	if (sock == -1) {
+		perror(argv[optind + 1]);
+		return (EXIT_FAILURE);
+	}
+
+	/* a client going away must not terminate the daemon */
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_mutex_init(&cfg.lock, NULL);
+	pthread_cond_init(&cfg.nonempty, NULL);
+
+	for (j = 0; j < pdb_jobs; j++) {
+		error = pthread_create(pool + j, NULL, solve_worker, &cfg);
+		if (error == 0)
+			continue;
+
+		errno = error;
+		perror("pthread_create");
+
+		if (j > 0)
+			break;
+
+		fprintf(stderr, "Couldn't create any threads, aborting...\n");
+		abort();
+	}
+
+	fprintf(stderr, "Serving on %s with %d threads\n", argv[optind + 1], j);
+	serve(&cfg, sock);
+
+	return (EXIT_SUCCESS);
+}
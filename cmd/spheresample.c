@@ -26,6 +26,8 @@
 /* spheresample.c -- generate spherical samples */
 
 #define _POSIX_C_SOURCE 200809L
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,31 +46,70 @@
 static void
 usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-vr] [-d pdbdir] [-j nproc] [-m fsmfile] [-n n_puzzle] [-N n_written] -o outfile [-s seed] catalogue distance\n", argv0);
+	fprintf(stderr, "Usage: %s [-vr] [-d pdbdir] [-j nproc] [-J nproc] [-m fsmfile] [-n n_puzzle] [-N n_written] -o outfile [-s seed] catalogue distance\n", argv0);
 
 	exit(EXIT_FAILURE);
 }
 
+enum {
+	/* number of samples taken from the work pile at once */
+	CHUNK_SIZE = 16,
+
+	/* print the state after every so many chunks */
+	PRINT_INTERVAL = 64,
+};
+
 /*
- * The current state of the sampling process.  This is updated once for
- * every puzzle and keeps track of how far we are done.
+ * The per-thread state of the sampling process.  Each thread draws its
+ * own random walks, writes to its own temporary file and keeps its own
+ * counters, so no locks need to be taken during sampling.  The
+ * counters are only ever written by the thread owning this structure
+ * but may be read by other threads to print the current state.  Each
+ * sampler gets a cache line of its own so the threads updating the
+ * counters of adjacent samplers do not contend for the same line.
  */
-struct samplestate {
-	/* members that may not be concurrently modified */
+struct sampler {
+	alignas(64) struct samplestate *state; /* shared sampling state */
 	FILE *outfile;		/* temporary file for sample data */
+	_Atomic long long n_samples; /* puzzles generated */
+	_Atomic long long n_accepted; /* puzzles with the right distance */
+	_Atomic long long n_aborted; /* aborted random walks */
+	long long path_sum;	/* sum of solution numbers */
+	_Atomic double size_sum; /* sum of reciprocal probabilities */
+};
+
+/*
+ * The current state of the sampling process.  The members n_samples,
+ * n_accepted, n_aborted, path_sum, and size_sum are computed from the
+ * per-thread samplers by merge_samplers() once sampling is done.
+ */
+struct samplestate {
+	/* members that are not modified during sampling */
 	const struct fsm *fsm;	/* finite state machine for sampling */
 	struct pdb_catalogue *cat; /* catalogue for searching */
 	long long n_puzzle;	/* total number of puzzles */
 	int verbose;		/* whether we want to print a status */
+	int steps;		/* number of steps to walk */
+	int n_sampler;		/* number of threads sampling */
+	int search_jobs;	/* number of threads per search */
+
+	_Atomic long long next_chunk; /* next chunk of samples to take */
+	struct sampler samplers[PDB_MAX_JOBS];
+
+	/*
+	 * for each chunk, the sampler that took it and the number of
+	 * samples it accepted, so fix_up() can read the samples in chunk
+	 * order regardless of how the chunks were scheduled.
+	 */
+	long long n_chunk;	/* number of chunks */
+	unsigned char *chunk_sampler, *chunk_accepted;
 
-	/* members that may only be accessed when lock is held */
-	pthread_mutex_t lock;	/* guards all members below* */
+	/* totals, valid after merge_samplers() */
 	long long n_samples;	/* puzzles generated */
 	long long n_accepted;	/* puzzles with the right distance */
 	long long n_aborted;	/* aborted random walks */
 	long long path_sum;	/* sum of solution numbers */
 	double size_sum;	/* sum of reciprocal probabilities */
-	int steps;		/* number of steps to walk */
 };
 
 /*
@@ -107,6 +148,18 @@ add_step(struct fsm_state *st, const struct fsm *fsm, int move, int budget)
 	return (n_legal);
 }
 
+/*
+ * Merge the payload of a search thread threadarg into plarg.
+ */
+static void
+merge_payload(void *plarg, void *threadarg)
+{
+	struct payload *pl = (struct payload *)plarg, *thread = (struct payload *)threadarg;
+
+	pl->prob += thread->prob;
+	pl->n_solution += thread->n_solution;
+}
+
 /*
  * Verify that pa would not have been pruned by plarg.  If
  * it would not be pruned, compute the probability of having
@@ -178,109 +231,124 @@ write_sample(FILE *outfile, const struct puzzle *p, double prob)
 /*
  * Report the current state of the sample-taking process to stderr.
  * If we write to a tty, each line is prefixed with \r, otherwise each
- * line ends in \n.
+ * line ends in \n.  As this is called while the other threads are
+ * still sampling, the state printed is only approximate.
  */
 static void
-print_state(const struct samplestate *state)
+print_state(struct samplestate *state)
 {
 	static const char *fmt = NULL;
-	long long total, samples, accepted, aborted, failed;
-	double ratio, size;
+	struct sampler *s;
+	long long total, samples = 0, accepted = 0, aborted = 0, failed;
+	double ratio, size, size_sum = 0.0;
+	int i;
 
 	if (fmt == NULL)
 		fmt = isatty(fileno(stderr))
 		    ? "\r%5.2f%% acc %5.2f%% fail %5.2f%% abort %5.2f%% done %#g size"
 		    :   "%5.2f%% acc %5.2f%% fail %5.2f%% abort %5.2f%% done %#g size\n";
 
+	for (i = 0; i < state->n_sampler; i++) {
+		s = state->samplers + i;
+		samples += atomic_load_explicit(&s->n_samples, memory_order_relaxed);
+		accepted += atomic_load_explicit(&s->n_accepted, memory_order_relaxed);
+		aborted += atomic_load_explicit(&s->n_aborted, memory_order_relaxed);
+		size_sum += atomic_load_explicit(&s->size_sum, memory_order_relaxed);
+	}
+
 	total = state->n_puzzle;
-	samples = state->n_samples;
-	accepted = state->n_accepted;
-	aborted = state->n_aborted;
 	failed = samples - accepted - aborted;
 	ratio = 100.0 / samples;
-	size = state->size_sum / state->n_samples;
+	size = size_sum / samples;
 	fprintf(stderr, fmt, accepted * ratio, failed * ratio, aborted * ratio,
 	    (100.0 * samples) / total, size);
 }
 
 /*
- * Take state->n_puzzle samples at state->steps steps using
- * state->fsmfile for pruning and write them to state->outfile.  Use
- * state->cat as an aid to solve the puzzle.  If state->verbose is
- * set, print status information every now and then.  This function
- * always returns NULL for compatibility with pthread_create.
+ * Take samples in chunks of CHUNK_SIZE until state->n_puzzle samples
+ * have been taken at state->steps steps using state->fsm for pruning
+ * and write them to the sampler's outfile.  Use state->cat as an aid
+ * to solve the puzzle.  Each chunk draws its random walks from its own
+ * random stream, so the samples taken only depend on the seed.  If
+ * state->verbose is set, print status information every now and then.
+ * This function always returns NULL for compatibility with
+ * pthread_create.
  */
 static void *
-take_samples(void *starg)
+take_samples(void *samplerarg)
 {
-	struct samplestate *state = (struct samplestate *)starg;
+	struct sampler *sampler = (struct sampler *)samplerarg;
+	struct samplestate *state = sampler->state;
+	struct random_state rs;
+	struct ida_config cfg = { 0 };
 	struct path pa;
 	struct puzzle p;
-	struct payload pl;
-	int error, success;
+	struct payload pl, thread_pls[PDB_MAX_JOBS];
+	void *thread_payloads[PDB_MAX_JOBS];
+	long long chunk, i, n;
+	int j, success, accepted;
 
 	pl.fsm = state->fsm;
 
-	error = pthread_mutex_lock(&state->lock);
-	if (error != 0) {
-		fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(error));
-		abort();
-	}
+	/* search hard samples with multiple threads if desired */
+	cfg.jobs = state->search_jobs;
+	cfg.payloads = thread_payloads;
+	cfg.merge = merge_payload;
+	for (j = 0; j < state->search_jobs; j++)
+		thread_payloads[j] = thread_pls + j;
+
+	for (;;) {
+		chunk = atomic_fetch_add_explicit(&state->next_chunk, 1, memory_order_relaxed);
+		if (chunk * CHUNK_SIZE >= state->n_puzzle)
+			break;
 
-	while (state->n_samples < state->n_puzzle) {
 		/* print state every once in a while */
-		if (state->verbose && state->n_samples % 1000 == 0)
+		if (state->verbose && chunk % PRINT_INTERVAL == 0)
 			print_state(state);
 
-		p = solved_puzzle;
-		state->n_samples++;
-		if (!random_walk(&p, state->steps, state->fsm)) {
-			state->n_aborted++;
-			continue;
-		}
+		n = state->n_puzzle - chunk * CHUNK_SIZE;
+		if (n > CHUNK_SIZE)
+			n = CHUNK_SIZE;
 
-		error = pthread_mutex_unlock(&state->lock);
-		if (error != 0) {
-			fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(error));
-			abort();
-		}
+		random_stream(&rs, chunk);
+		accepted = 0;
 
-		pl.prob = 0.0;
-		pl.n_solution = 0;
-		pl.zloc = zero_location(&p);
+		for (i = 0; i < n; i++) {
+			p = solved_puzzle;
+			sampler->n_samples++;
+			if (!random_walk_r(&rs, &p, state->steps, state->fsm)) {
+				sampler->n_aborted++;
+				continue;
+			}
 
-		search_ida(state->cat, &fsm_simple, &p, &pa, add_solution, &pl, IDA_LAST_FULL);
-		assert(pa.pathlen <= state->steps);
-		success = pa.pathlen == state->steps;
+			pl.prob = 0.0;
+			pl.n_solution = 0;
+			pl.zloc = zero_location(&p);
+			for (j = 0; j < state->search_jobs; j++)
+				thread_pls[j] = pl;
 
-		if (success)  {
-			/* we came there some way, so we should always find a solution */
-			assert(pl.n_solution > 0);
+			search_ida_config(state->cat, &fsm_simple, &cfg, &p, SEARCH_PATH_LEN,
+			    &pa, add_solution, &pl, IDA_LAST_FULL);
+			assert(pa.pathlen <= state->steps);
+			success = pa.pathlen == state->steps;
 
-			/*
-			 * A FILE structure has its own lock, so this can be
-			 * done without holding state->lock.
-			 */
-			write_sample(state->outfile, &p, pl.prob);
-		}
+			if (!success)
+				continue;
 
-		error = pthread_mutex_lock(&state->lock);
-		if (error != 0) {
-			fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(error));
-			abort();
-		}
+			/* we came there some way, so we should always find a solution */
+			assert(pl.n_solution > 0);
 
-		if (success) {
-			state->n_accepted++;
-			state->path_sum += pl.n_solution;
-			state->size_sum += 1.0 / pl.prob;
+			write_sample(sampler->outfile, &p, pl.prob);
+			accepted++;
+			sampler->n_accepted++;
+			sampler->path_sum += pl.n_solution;
+			atomic_store_explicit(&sampler->size_sum, 1.0 / pl.prob +
+			    atomic_load_explicit(&sampler->size_sum, memory_order_relaxed),
+			    memory_order_relaxed);
 		}
-	}
 
-	error = pthread_mutex_unlock(&state->lock);
-	if (error != 0) {
-		fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(error));
-		abort();
+		state->chunk_sampler[chunk] = (unsigned char)(sampler - state->samplers);
+		state->chunk_accepted[chunk] = (unsigned char)accepted;
 	}
 
 	return (NULL);
@@ -289,27 +357,56 @@ take_samples(void *starg)
 /*
  * Take state->n_puzzle samples using up to pdb_jobs threads in
  * parallel.  Otherwise same as take_samples (which does the
- * heavy lifting).
+ * heavy lifting).  Each thread writes its samples to its own
+ * temporary file.
  */
 static void
 take_samples_parallel(struct samplestate *state)
 {
 	/* shamelessly ripped from parallel.c */
 	pthread_t pool[PDB_MAX_JOBS];
+	struct sampler *s;
 
 	int i, jobs, error;
 
 	jobs = pdb_jobs;
+	state->next_chunk = 0;
+	state->n_chunk = (state->n_puzzle + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	state->chunk_sampler = malloc(state->n_chunk);
+	state->chunk_accepted = malloc(state->n_chunk);
+	if (state->n_chunk > 0 && (state->chunk_sampler == NULL || state->chunk_accepted == NULL)) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < jobs; i++) {
+		s = state->samplers + i;
+		s->state = state;
+		s->n_samples = 0;
+		s->n_accepted = 0;
+		s->n_aborted = 0;
+		s->path_sum = 0;
+		s->size_sum = 0.0;
+
+		/* file for samples before they are fixed up */
+		s->outfile = tmpfile();
+		if (s->outfile == NULL) {
+			perror("tmpfile");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	state->n_sampler = jobs;
 
 	/* for easier debugging, don't multithread when jobs == 1 */
 	if (jobs == 1) {
-		take_samples(state);
+		take_samples(state->samplers);
 		goto end;
 	}
 
 	/* spawn threads */
 	for (i = 0; i < jobs; i++) {
-		error = pthread_create(pool + i, NULL, take_samples, state);
+		error = pthread_create(pool + i, NULL, take_samples, state->samplers + i);
 		if (error != 0) {
 			/* accept less threads, but not none */
 			if (i > 0)
@@ -339,23 +436,53 @@ end:	if (state->verbose) {
 	}
 }
 
+/*
+ * Add up the counters of all samplers in state and store the totals
+ * in state.
+ */
+static void
+merge_samplers(struct samplestate *state)
+{
+	struct sampler *s;
+	int i;
+
+	state->n_samples = 0;
+	state->n_accepted = 0;
+	state->n_aborted = 0;
+	state->path_sum = 0;
+	state->size_sum = 0.0;
+
+	for (i = 0; i < state->n_sampler; i++) {
+		s = state->samplers + i;
+		state->n_samples += s->n_samples;
+		state->n_accepted += s->n_accepted;
+		state->n_aborted += s->n_aborted;
+		state->path_sum += s->path_sum;
+		state->size_sum += s->size_sum;
+	}
+}
+
 /*
  * after initial sampling, the probabilities need to be adjusted to be
  * relative to the chance of hitting an accepted sample, not just any
  * sample at all.  This is done by multiplying each prob with
- * state->n_samples/state->n_accepted.  Discard all but the first n_out
- * samples after adding them to the statistic.  If report is set, a
+ * state->n_samples/state->n_accepted.  The samples are read from the
+ * temporary files of the samplers in chunk order, so the output only
+ * depends on the seed.  Discard all but the first n_out samples after
+ * adding them to the statistic.  If report is set, a
  * CSV-formatted report of the results is printed.  Additionally, some
  * statistical numbers are computed and printed out if verbose is set.
  */
 static void
-fix_up(FILE *outfile, FILE *prelimfile, struct samplestate *state,
-    long long n_out, int report, int verbose)
+fix_up(FILE *outfile, struct samplestate *state, long long n_out,
+    int report, int verbose)
 {
 	struct sample s;
+	FILE *prelimfile;
 	double size, adjust, variance = 0.0, p_1, paths, error;
-	long long i;
+	long long i, chunk;
 	size_t count, samples_read = 0;
+	int j;
 
 	if (state->n_accepted == 0) {
 		fprintf(stderr, "no samples obtained\n");
@@ -368,30 +495,47 @@ fix_up(FILE *outfile, FILE *prelimfile, struct samplestate *state,
 	adjust = (double)state->n_samples / state->n_accepted;
 	size = state->size_sum / state->n_samples;
 
-	rewind(prelimfile);
+	for (j = 0; j < state->n_sampler; j++)
+		rewind(state->samplers[j].outfile);
 
+	/* each sampler took its chunks in ascending order */
 	i = 0;
-	while (count = fread(&s, sizeof s, 1, prelimfile), count == 1) {
-		samples_read++;
+	for (chunk = 0; chunk < state->n_chunk; chunk++) {
+		prelimfile = state->samplers[state->chunk_sampler[chunk]].outfile;
+
+		for (j = 0; j < state->chunk_accepted[chunk]; j++) {
+			count = fread(&s, sizeof s, 1, prelimfile);
+			if (count != 1) {
+				if (ferror(prelimfile))
+					perror("fread");
+				else
+					fprintf(stderr, "fread: unexpected end of file\n");
+
+				exit(EXIT_FAILURE);
+			}
 
-		s.p *= adjust;
-		p_1 = 1.0 / s.p;
-		variance += (size - p_1) * (size - p_1);
+			samples_read++;
 
-		if (i++ >= n_out)
-			continue;
+			s.p *= adjust;
+			p_1 = 1.0 / s.p;
+			variance += (size - p_1) * (size - p_1);
 
-		count = fwrite(&s, sizeof s, 1, outfile);
-		if (count != 1) {
-			perror("fwrite");
-			exit(EXIT_FAILURE);
+			if (i++ >= n_out)
+				continue;
+
+			count = fwrite(&s, sizeof s, 1, outfile);
+			if (count != 1) {
+				perror("fwrite");
+				exit(EXIT_FAILURE);
+			}
 		}
 	}
 
-	if (ferror(prelimfile)) {
-		perror("fread");
-		exit(EXIT_FAILURE);
-	}
+	for (j = 0; j < state->n_sampler; j++)
+		fclose(state->samplers[j].outfile);
+
+	free(state->chunk_sampler);
+	free(state->chunk_accepted);
 
 	assert(samples_read == state->n_accepted);
 
@@ -421,12 +565,12 @@ main(int argc, char *argv[])
 	struct samplestate state;
 	const struct fsm *fsm = &fsm_simple;
 	struct pdb_catalogue *cat;
-	FILE *fsmfile, *prelimfile, *outfile = NULL;
+	FILE *fsmfile, *outfile = NULL;
 	long long n_puzzle = 1000, n_out = -1;
-	int optchar, report = 0, verbose = 0, error;
+	int optchar, report = 0, verbose = 0, search_jobs = 1;
 	char *pdbdir = NULL;
 
-	while (optchar = getopt(argc, argv, "d:j:m:n:N:o:rs:v"), optchar != -1)
+	while (optchar = getopt(argc, argv, "d:J:j:m:n:N:o:rs:v"), optchar != -1)
 		switch (optchar) {
 		case 'd':
 			pdbdir = optarg;
@@ -442,6 +586,16 @@ main(int argc, char *argv[])
 
 			break;
 
+		case 'J':
+			search_jobs = atoi(optarg);
+			if (search_jobs < 1 || search_jobs > PDB_MAX_JOBS) {
+				fprintf(stderr, "Number of threads must be between 1 and %d\n",
+				    PDB_MAX_JOBS);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
 		case 'm':
 			fsmfile = fopen(optarg, "rb");
 			if (fsmfile == NULL) {
@@ -505,30 +659,11 @@ main(int argc, char *argv[])
 		return (EXIT_FAILURE);
 	}
 
-	/* file for samples before they are fixed up */
-	prelimfile = tmpfile();
-	if (prelimfile == NULL) {
-		perror("tmpfile");
-		return (EXIT_FAILURE);
-	}
-
-	state.outfile = prelimfile;
 	state.fsm = fsm;
 	state.cat = cat;
 	state.n_puzzle = n_puzzle;
 	state.verbose = verbose;
-
-	error = pthread_mutex_init(&state.lock, NULL);
-	if (error != 0) {
-		fprintf(stderr, "pthread_mutex_init: %s\n", strerror(error));
-		return (EXIT_FAILURE);
-	}
-
-	state.n_samples = 0;
-	state.n_accepted = 0;
-	state.n_aborted = 0;
-	state.path_sum = 0;
-	state.size_sum = 0.0;
+	state.search_jobs = search_jobs;
 	state.steps = (int)strtol(argv[optind + 1], NULL, 0);
 	if (state.steps < 0) {
 		fprintf(stderr, "Number of steps cannot be negative: %s\n", argv[optind + 1]);
@@ -536,10 +671,11 @@ main(int argc, char *argv[])
 	}
 
 	take_samples_parallel(&state);
+	merge_samplers(&state);
 
 	if (n_out < 0)
 		n_out = n_puzzle;
-	fix_up(outfile, prelimfile, &state, n_out, report, verbose);
+	fix_up(outfile, &state, n_out, report, verbose);
 
 	return (EXIT_SUCCESS);
 }
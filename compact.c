@@ -165,6 +165,22 @@ unpack_puzzle(struct puzzle *restrict p, const struct compact_puzzle *restrict c
 #endif
 }
 
+/*
+ * Unpack n compact puzzles into the array p.  The compact puzzles are
+ * taken from records, which are stride bytes apart.  This allows
+ * unpacking the puzzles embedded in records of other types (such as
+ * struct sample) straight from a sample file.
+ */
+extern void
+unpack_puzzles(struct puzzle *restrict p, const void *restrict records,
+    size_t stride, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		unpack_puzzle(p + i, (const struct compact_puzzle *)((const char *)records + i * stride));
+}
+
 /*
  * Compare two struct compact_puzzle in a manner suitable for qsort.
  */
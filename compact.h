@@ -58,6 +58,7 @@ struct cp_slice {
 extern void	pack_puzzle(struct compact_puzzle *restrict, const struct puzzle *restrict);
 extern void	pack_puzzle_masked(struct compact_puzzle *restrict, const struct puzzle *restrict, int);
 extern void	unpack_puzzle(struct puzzle *restrict, const struct compact_puzzle *restrict);
+extern void	unpack_puzzles(struct puzzle *restrict, const void *restrict, size_t, size_t);
 extern int	compare_cp(const void *, const void *);
 extern int	compare_cp_nomask(const void *, const void *);
 
@@ -35,11 +35,15 @@
 
 #include "bitpdb.h"
 #include "heuristic.h"
+#include "perimeter.h"
 #include "transposition.h"
 #include "tileset.h"
 #include "puzzle.h"
 #include "pdb.h"
 
+/* number of configurations looked up at once by batch lookups */
+enum { HEU_HVALS_CHUNK = 64 };
+
 /*
  * A heuristic function driver.  Each driver is responsible for some
  * heuristic types as described in the drivers array.  drivers behave
@@ -53,6 +57,7 @@ typedef int heu_driver(struct heuristic *heu, const char *heudir,
 static heu_driver pdb_driver, ipdb_driver, zpdb_driver;
 static heu_driver bitpdb_driver, zbitpdb_driver;
 static heu_driver bitpdb_zstd_driver, zbitpdb_zstd_driver;
+static heu_driver ball_driver;
 
 /*
  * All available drivers.  The array is terminated with a NULL sentinel.
@@ -75,6 +80,8 @@ const struct {
 	"bpdb.zst", bitpdb_zstd_driver, 0,
 	"zbpdb.zst", zbitpdb_zstd_driver, HEU_ZEROTILE,
 
+	"ball", ball_driver, HEU_ZEROTILE,
+
 	"pdb", bitpdb_driver, HEU_SIMILAR,
 	"zpdb", zbitpdb_driver, HEU_SIMILAR | HEU_ZEROTILE,
 	"bpdb.zst", bitpdb_driver, HEU_SIMILAR,
@@ -224,6 +231,43 @@ success:
 	return (0);
 }
 
+/*
+ * Look up the h values for the n puzzle configurations p in heu and
+ * store them to hvals[0], hvals[stride], hvals[2 * stride], and so on.
+ * The results are the same as if heu_hval() was called on each
+ * configuration, but if the heuristic provider supports batch lookups,
+ * this is considerably faster.
+ */
+extern void
+heu_hvals(struct heuristic *heu, unsigned char *hvals, size_t stride,
+    const struct puzzle *p, size_t n)
+{
+	struct puzzle p_morphed[HEU_HVALS_CHUNK];
+	size_t i, j, len;
+
+	if (heu->hvals == NULL) {
+		for (i = 0; i < n; i++)
+			hvals[i * stride] = heu_hval(heu, p + i);
+
+		return;
+	}
+
+	if (heu->morphism == 0) {
+		heu->hvals(heu->provider, hvals, stride, p, n);
+		return;
+	}
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < HEU_HVALS_CHUNK ? n - i : HEU_HVALS_CHUNK;
+		for (j = 0; j < len; j++) {
+			p_morphed[j] = p[i + j];
+			morph(p_morphed + j, heu->morphism);
+		}
+
+		heu->hvals(heu->provider, hvals + i * stride, stride, p_morphed, len);
+	}
+}
+
 /*
  * hval, hdiff, and free implementations for struct patterndb based heuristics.
  */
@@ -243,6 +287,32 @@ pdb_hdiff_wrapper(void *provider, const struct puzzle *p, int old_h)
 	return (pdb_lookup_puzzle((struct patterndb *)provider, p));
 }
 
+/*
+ * Compute the indices for a chunk of puzzles and prefetch the
+ * corresponding entries before looking any of them up.  This way, the
+ * cache misses for the whole chunk are serviced in parallel instead of
+ * one after another.
+ */
+static void
+pdb_hvals_wrapper(void *provider, unsigned char *hvals, size_t stride,
+    const struct puzzle *p, size_t n)
+{
+	struct patterndb *pdb = provider;
+	struct index idx[HEU_HVALS_CHUNK];
+	size_t i, j, len;
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < HEU_HVALS_CHUNK ? n - i : HEU_HVALS_CHUNK;
+		for (j = 0; j < len; j++) {
+			compute_index(&pdb->aux, idx + j, p + i + j);
+			pdb_prefetch(pdb, idx + j);
+		}
+
+		for (j = 0; j < len; j++)
+			hvals[(i + j) * stride] = pdb_lookup(pdb, idx + j);
+	}
+}
+
 static void
 pdb_free_wrapper(void *provider)
 {
@@ -393,6 +463,7 @@ success:
 	heu->provider = pdb;
 	heu->hval = pdb_hval_wrapper;
 	heu->hdiff = pdb_hdiff_wrapper;
+	heu->hvals = pdb_hvals_wrapper;
 	heu->free = pdb_free_wrapper;
 
 	return (0);
@@ -601,6 +672,7 @@ success:
 	heu->provider = bpdb;
 	heu->hval = bitpdb_hval_wrapper;
 	heu->hdiff = bitpdb_hdiff_wrapper;
+	heu->hvals = NULL;
 	heu->free = bitpdb_free_wrapper;
 
 	return (0);
@@ -661,3 +733,111 @@ bitpdb_zstd_driver(struct heuristic *heu, const char *heudir,
 	return (common_bitpdb_driver(heu, heudir, ts, tsstr, flags,
 	    "bpdb.zst", bitpdb_load_compressed, bitpdb_store_compressed));
 }
+
+/*
+ * hval, hdiff, hvals, and free implementations for perimeter based
+ * heuristics.  As adjacent configurations differ in distance by
+ * exactly one, the layer below old_h is the closest one a
+ * differential lookup needs to search.
+ */
+static int
+ball_hval_wrapper(void *provider, const struct puzzle *p)
+{
+
+	return (perimeter_lookup((struct perimeter *)provider, p, 0));
+}
+
+static int
+ball_hdiff_wrapper(void *provider, const struct puzzle *p, int old_h)
+{
+
+	return (perimeter_lookup((struct perimeter *)provider, p, old_h - 1));
+}
+
+static void
+ball_hvals_wrapper(void *provider, unsigned char *hvals, size_t stride,
+    const struct puzzle *p, size_t n)
+{
+
+	perimeter_lookups((struct perimeter *)provider, hvals, stride, p, n);
+}
+
+static void
+ball_free_wrapper(void *provider)
+{
+
+	perimeter_free((struct perimeter *)provider);
+}
+
+/*
+ * Driver for endgame databases: a perimeter of all configurations
+ * within some radius of the solved configuration as written by
+ * cmd/pdbsearch -p.  Configurations within the perimeter get their
+ * exact distance, all others a lower bound of at least the radius plus
+ * one.  As the whole puzzle is involved, ts must comprise all tiles.
+ * The radius is chosen when generating the file, so the heuristic
+ * cannot be created here.
+ */
+static int
+ball_driver(struct heuristic *heu, const char *heudir,
+    tileset ts, char *tsstr_arg, int flags)
+{
+	FILE *perimfile;
+	struct perimeter *per;
+	int saved_errno;
+	char tsstr[TILESET_LIST_LEN], pathbuf[PATH_MAX];
+
+	(void)tsstr_arg;
+	ts = tileset_add(ts, ZERO_TILE);
+	if (ts != FULL_TILESET || heudir == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	tileset_list_string(tsstr, ts);
+	if (snprintf(pathbuf, PATH_MAX, "%s/%s.per", heudir, tsstr) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		if (flags & HEU_VERBOSE) {
+			perror("ball_driver");
+			errno = ENAMETOOLONG;
+		}
+
+		return (-1);
+	}
+
+	perimfile = fopen(pathbuf, "rb");
+	if (perimfile == NULL) {
+		saved_errno = errno;
+		if (flags & HEU_VERBOSE && (errno != ENOENT || flags & HEU_CREATE)) {
+			perror(pathbuf);
+			errno = saved_errno;
+		}
+
+		return (-1);
+	}
+
+	if (flags & HEU_VERBOSE)
+		fprintf(stderr, "Loading perimeter file %s\n", pathbuf);
+
+	per = perimeter_load(perimfile);
+	saved_errno = errno;
+	fclose(perimfile);
+
+	if (per == NULL) {
+		errno = saved_errno;
+		if (flags & HEU_VERBOSE) {
+			perror("perimeter_load");
+			errno = saved_errno;
+		}
+
+		return (-1);
+	}
+
+	heu->provider = per;
+	heu->hval = ball_hval_wrapper;
+	heu->hdiff = ball_hdiff_wrapper;
+	heu->hvals = ball_hvals_wrapper;
+	heu->free = ball_free_wrapper;
+
+	return (0);
+}
@@ -41,7 +41,10 @@
  * The underlying heuristic provider is queried using the hval function
  * provider.  A differential query can be made using the hdiff function
  * pointer which, given two adjacent puzzle configurations and the h
- * value for one of them, yields the h value for the other.  A call to
+ * value for one of them, yields the h value for the other.  The
+ * optional hvals function pointer looks up the h values for an array
+ * of puzzle configurations at once, storing them stride bytes apart.
+ * It is NULL if the provider has no batch lookup.  A call to
  * the free function pointer should release the storage associated with
  * the underlying heuristic.  If derived is set, the heuristic has been
  * derived from another one and heu_free() is a no-op.
@@ -50,6 +53,7 @@ struct heuristic {
 	void *provider;
 	int (*hval)(void *, const struct puzzle *);
 	int (*hdiff)(void *, const struct puzzle *, int);
+	void (*hvals)(void *, unsigned char *, size_t, const struct puzzle *, size_t);
 	void (*free)(void *);
 	tileset ts;
 	unsigned morphism; /* the automorphism to apply */
@@ -72,12 +76,15 @@ enum {
  * zpdb    zero-aware pattern database
  * bitpdb  additive bit pattern database
  * zbitpdb zero-aware bit pattern database
+ * ball    endgame database of all configurations close to the goal,
+ *         only for the full tile set
  *
  * the type can be suffixed with ".zst" to make heu_open generate a
  * zstd compressed pattern database.
  */
 
 extern int	heu_open(struct heuristic *, const char *, tileset, const char *, int);
+extern void	heu_hvals(struct heuristic *, unsigned char *, size_t, const struct puzzle *, size_t);
 
 /*
  * Look up the h value provided by heu for p.
@@ -139,6 +146,7 @@ heu_morph(struct heuristic *heu, struct heuristic *oldheu, int morphism)
 {
 	heu->provider = oldheu->provider;
 	heu->hval = oldheu->hval;
+	heu->hvals = oldheu->hvals;
 	heu->free = oldheu->free;
 	heu->ts = tileset_morph(oldheu->ts, morphism);
 	heu->morphism = compose_morphisms(oldheu->morphism, inverse_morphism(morphism));
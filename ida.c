@@ -28,46 +28,322 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <setjmp.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "catalogue.h"
+#include "compact.h"
 #include "fsm.h"
 #include "pdb.h"
+#include "perfcount.h"
+#include "perimeter.h"
 #include "puzzle.h"
 #include "search.h"
 #include "tileset.h"
 #include "transposition.h"
+#include "ttable.h"
 
+/*
+ * The transposition table is only used for nodes whose h value is at
+ * least TTABLE_MIN_SLACK below what the bound permits.  Smaller
+ * subtrees are cheaper to search again than to look up.
+ */
+enum { TTABLE_MIN_SLACK = 2 };
+
+/*
+ * When searching a round in parallel, the search tree is first
+ * expanded to a split depth chosen such that there are at least
+ * SUBTREES_PER_JOB subtrees per thread.  Each subtree is then searched
+ * by whichever thread comes first, including threads joining from an
+ * ida_pool while the round is in progress.
+ */
+enum { SUBTREES_PER_JOB = 16 };
+
+/*
+ * Node and time limits and cancellation are checked every
+ * LIMIT_INTERVAL nodes expanded by each thread, which must be a power
+ * of two.  Checking is cheap, but reading the clock is not.
+ */
+enum { LIMIT_INTERVAL = 1 << 20 };
+
+/*
+ * The limits of a search, shared by all threads searching it.  Each
+ * thread adds LIMIT_INTERVAL to expanded whenever it checks the limits,
+ * so expanded approximates the number of nodes expanded so far.  hit
+ * is set once a limit has been reached.
+ */
+struct search_limits {
+	unsigned long long node_limit;
+	atomic_ullong expanded;
+	struct timespec deadline;
+	atomic_int *cancel;
+	atomic_int hit;
+	int use_deadline;
+};
+
+/*
+ * A subtree to be searched: the configuration p at depth g with its
+ * partial h values, FSM state, the arguments from and parent_h to
+ * expand_node(), and the path leading to p.
+ */
+struct subtree {
+	struct puzzle p;
+	struct partial_hvals ph;
+	struct fsm_state st;
+	struct path path;
+	size_t parent_h;
+	int from;
+};
+
+/*
+ * The subtrees of a parallel round.  Subtrees are collected at depth
+ * and handed out to the threads using next_subtree.  Unless all
+ * solutions are wanted, stop is set once a solution has been found so
+ * the other threads give up.  If the round is open to helpers from an
+ * ida_pool, it is linked into the pool's list of splits through next
+ * and sst is the search state helpers start out with.  The results of
+ * the helpers are gathered in the remaining members.  These members
+ * are protected by the pool's lock.
+ */
+struct split {
+	struct subtree *subtrees;
+	size_t n_subtrees, cap, depth;
+	_Atomic size_t next_subtree;
+	atomic_int stop;
+
+	struct split *next;
+	const struct search_state *sst;
+	struct path path;
+	size_t next_bound;
+	unsigned long long expanded, pruned, duplicates;
+	int helpers, n_solutions;
+};
+
+/*
+ * The state of a search.  next_bound is the least f value of the nodes
+ * cut off by the bound so far, which is the bound the next round needs
+ * to expand any node not expanded in this round.
+ */
 struct search_state {
 	jmp_buf finish;
+	struct split *split;
+	atomic_int *stop;
+	struct search_limits *limits;
 	struct pdb_catalogue *cat;
 	const struct fsm *fsm;
+	const struct perimeter *perimeter;
+	struct ttable *ttable;
 	struct path *path;
-	size_t bound;
-	unsigned long long expanded, pruned;
+	size_t bound, next_bound;
+	unsigned long long expanded, pruned, duplicates;
+	unsigned generation;
 	int n_solutions, flags;
 	void (*on_solved)(const struct path *, void *);
 	void *on_solved_payload;
 };
 
+/*
+ * Improve the h value h for p using perimeter per.  If p is within
+ * the perimeter, return its exact distance and store the mask of moves
+ * leading closer to the solved configuration to *towards.  Otherwise,
+ * return h or the least distance a configuration outside of the
+ * perimeter can have, whichever is larger, and set *towards to -1,
+ * permitting all moves.
+ */
+static size_t
+perimeter_hval(const struct perimeter *per, const struct puzzle *p,
+    size_t h, int *towards)
+{
+	size_t bound;
+	int d;
+
+	*towards = -1;
+	if (per == NULL)
+		return (h);
+
+	if (h <= (size_t)per->radius) {
+		d = perimeter_distance(per, p, (int)h, towards);
+		if (d >= 0)
+			return (d);
+
+		*towards = -1;
+	}
+
+	bound = perimeter_bound(per, distance_parity(p));
+
+	return (h > bound ? h : bound);
+}
+
+/*
+ * Record configuration p at depth g reached through path as a subtree
+ * to be searched.  The remaining arguments are as for expand_node().
+ */
+static void
+add_subtree(struct split *split, const struct puzzle *p,
+    const struct partial_hvals *ph, struct fsm_state st,
+    const struct path *path, size_t g, int from, size_t parent_h)
+{
+	struct subtree *sub;
+
+	if (split->n_subtrees >= split->cap) {
+		split->cap = split->cap == 0 ? 64 : split->cap * 2;
+		split->subtrees = realloc(split->subtrees, split->cap * sizeof *split->subtrees);
+		if (split->subtrees == NULL) {
+			perror("realloc");
+			abort();
+		}
+	}
+
+	sub = split->subtrees + split->n_subtrees++;
+	sub->p = *p;
+	sub->ph = *ph;
+	sub->st = st;
+	memcpy(sub->path.moves, path->moves, g);
+	sub->path.pathlen = g;
+	sub->parent_h = parent_h;
+	sub->from = from;
+}
+
+/*
+ * A child of a node to be searched by expand_ordered(): the location
+ * the zero tile is moved to, the FSM state after the move, and the
+ * child's partial h values and h value.
+ */
+struct child {
+	struct partial_hvals ph;
+	struct fsm_state st;
+	size_t h;
+	int dest;
+};
+
+static size_t	expand_node(struct search_state *, size_t, struct puzzle *,
+    struct fsm_state, struct partial_hvals *, int, size_t);
+
+/*
+ * Return 1 if one of the limits in lim has been reached after expanding
+ * expanded nodes, 0 otherwise.
+ */
+static int
+limits_reached(struct search_limits *lim, unsigned long long expanded)
+{
+	struct timespec now;
+
+	if (lim->node_limit > 0 && expanded >= lim->node_limit)
+		return (1);
+
+	if (lim->cancel != NULL && atomic_load_explicit(lim->cancel, memory_order_relaxed))
+		return (1);
+
+	if (lim->use_deadline && clock_gettime(CLOCK_MONOTONIC, &now) == 0
+	    && (now.tv_sec > lim->deadline.tv_sec
+	    || now.tv_sec == lim->deadline.tv_sec && now.tv_nsec >= lim->deadline.tv_nsec))
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Account for another LIMIT_INTERVAL nodes expanded by the calling
+ * thread.  If this reaches a limit, give up the search.
+ */
+static void
+check_limits(struct search_state *sst)
+{
+	unsigned long long expanded;
+
+	expanded = atomic_fetch_add_explicit(&sst->limits->expanded,
+	    LIMIT_INTERVAL, memory_order_relaxed) + LIMIT_INTERVAL;
+	if (limits_reached(sst->limits, expanded)) {
+		atomic_store_explicit(&sst->limits->hit, 1, memory_order_relaxed);
+		longjmp(sst->finish, 1);
+	}
+}
+
+/*
+ * Search the n_children children of p (which is at depth g, has
+ * partial h values ph and h value h) reached by moving the zero tile
+ * to dests[i] with FSM states sts[i] in order of increasing h value,
+ * so the most promising child comes first.  Return the least f value
+ * found for the children as expand_node() does.
+ */
+static size_t
+expand_ordered(struct search_state *sst, size_t g, struct puzzle *p,
+    const struct partial_hvals *ph, size_t h, const int *dests,
+    const struct fsm_state *sts, size_t n_children)
+{
+	struct child children[4], tmp;
+	size_t i, j, f, min_f = SIZE_MAX, zloc = zero_location(p), tile;
+
+	for (i = 0; i < n_children; i++) {
+		children[i].dest = dests[i];
+		children[i].st = sts[i];
+		tile = p->grid[children[i].dest];
+		move(p, children[i].dest);
+		children[i].ph = *ph;
+		catalogue_diff_hvals(&children[i].ph, sst->cat, p, tile);
+		children[i].h = catalogue_ph_hval(sst->cat, &children[i].ph);
+		move(p, zloc);
+
+		/* insertion sort, stable so ties keep the move order */
+		for (j = i; j > 0 && children[j - 1].h > children[j].h; j--) {
+			tmp = children[j];
+			children[j] = children[j - 1];
+			children[j - 1] = tmp;
+		}
+	}
+
+	for (i = 0; i < n_children; i++) {
+		sst->path->moves[g] = children[i].dest;
+		move(p, children[i].dest);
+		f = expand_node(sst, g + 1, p, children[i].st, &children[i].ph, zloc, h);
+		move(p, zloc);
+
+		if (f < min_f)
+			min_f = f;
+	}
+
+	return (min_f);
+}
+
 /*
  * Expand the search tree for configuration p recursively.  Assume the
  * search path up to here has had length g already.  Use the search
- * state in sst.
+ * state in sst.  Within the perimeter, the exact distance to the goal
+ * is known and only moves leading closer to the goal are followed.
+ * from is the location the zero tile was moved from to reach p, or -1
+ * if p is the root of the search, and parent_h is a lower bound for the
+ * distance of that configuration to the goal.  Return a lower bound
+ * for the distance of p to the goal plus g, which is backed up into
+ * the transposition table.  The least f value of the nodes cut off by
+ * the bound is kept track of in sst->next_bound.  Nodes pruned by the
+ * FSM or the transposition table are not cut off by the bound, so
+ * they do not count towards it.
  */
-static void
+static size_t
 expand_node(struct search_state *sst, size_t g, struct puzzle *p,
-    struct fsm_state st, struct partial_hvals *ph)
+    struct fsm_state st, struct partial_hvals *ph, int from, size_t parent_h)
 {
 	struct partial_hvals pph;
 	struct fsm_state ast;
-	size_t i, h, n_moves, zloc, dest, tile;
+	struct compact_puzzle cp;
+	struct ttable_info info;
+	struct fsm_state sts[4];
+	size_t i, h, n_moves, zloc, dest, tile, f, min_f = SIZE_MAX, n_children = 0;
+	int towards, use_ttable, order, dests[4];
 	const signed char *moves;
 
+	/* has another thread found a solution? */
+	if (sst->stop != NULL && atomic_load_explicit(sst->stop, memory_order_relaxed))
+		longjmp(sst->finish, 1);
+
 	h = catalogue_ph_hval(sst->cat, ph);
 	if (h == 0 && memcmp(p->tiles, solved_puzzle.tiles, TILE_COUNT) == 0) {
 		sst->n_solutions++;
@@ -82,23 +358,96 @@ expand_node(struct search_state *sst, size_t g, struct puzzle *p,
 		if (~sst->flags & IDA_LAST_FULL)
 			longjmp(sst->finish, 1);
 
-		return;
+		return (g);
 	}
 
-	if (g + h > sst->bound)
-		return;
+	h = perimeter_hval(sst->perimeter, p, h, &towards);
+
+	/*
+	 * Only consult the table for nodes with large enough subtrees.
+	 * While splitting, the values we back up are incomplete, so
+	 * the table must not be used either.
+	 */
+	use_ttable = sst->ttable != NULL && sst->split == NULL
+	    && g + h + TTABLE_MIN_SLACK <= sst->bound;
+	if (use_ttable) {
+		pack_puzzle(&cp, p);
+		if (ttable_lookup(sst->ttable, &info, &cp)) {
+			if (info.hval > h)
+				h = info.hval;
+
+			/*
+			 * If p has already been searched from no deeper
+			 * than here this round and in the same FSM state,
+			 * there is nothing new to find unless we want to
+			 * find all paths.  In another FSM state, different
+			 * moves are pruned, so the earlier search may have
+			 * missed paths we would find.
+			 */
+			if (info.generation == sst->generation && info.g <= g
+			    && info.fsm_state == st.state
+			    && ~sst->flags & IDA_LAST_FULL) {
+				sst->duplicates++;
+				return (g + h);
+			}
+		}
+	}
+
+	if (g + h > sst->bound) {
+		if (g + h < sst->next_bound)
+			sst->next_bound = g + h;
+
+		return (g + h);
+	}
+
+	/* leave p to be searched by a thread later on */
+	if (sst->split != NULL && g == sst->split->depth) {
+		add_subtree(sst->split, p, ph, st, sst->path, g, from, parent_h);
+		return (SIZE_MAX);
+	}
+
+	if (use_ttable) {
+		info.generation = sst->generation;
+		info.fsm_state = st.state;
+		info.g = g;
+		info.hval = h;
+		ttable_store(sst->ttable, &info, &cp);
+	}
 
 	fsm_prefetch(sst->fsm, st);
 	sst->expanded++;
+
+	/* limits are not checked while splitting */
+	if (sst->limits != NULL && (sst->expanded & LIMIT_INTERVAL - 1) == 0
+	    && sst->split == NULL)
+		check_limits(sst);
+	order = (sst->flags & (IDA_ORDER | IDA_LAST_FULL)) == IDA_ORDER;
 	zloc = zero_location(p);
 	moves = get_moves(zloc);
 	n_moves = move_count(zloc);
 
 	for (i = 0; i < n_moves; i++) {
 		dest = moves[i];
+
+		/* moves away from the goal within the perimeter */
+		if (~towards & 1 << i) {
+			f = g + h + 2;
+			goto next;
+		}
+
 		ast = fsm_advance_idx(sst->fsm, st, i);
 		if (fsm_is_match(ast)) {
 			sst->pruned++;
+
+			/* a neighbour is at most one move closer than p */
+			f = (int)dest == from ? g + 1 + parent_h : g + h;
+			goto next;
+		}
+
+		/* defer the child to expand_ordered() if ordering */
+		if (order) {
+			dests[n_children] = dest;
+			sts[n_children++] = ast;
 			continue;
 		}
 
@@ -108,37 +457,430 @@ expand_node(struct search_state *sst, size_t g, struct puzzle *p,
 		move(p, dest);
 		pph = *ph;
 		catalogue_diff_hvals(&pph, sst->cat, p, tile);
-		expand_node(sst, g + 1, p, ast, &pph);
+		f = expand_node(sst, g + 1, p, ast, &pph, zloc, h);
 		move(p, zloc);
+
+	next:	if (f < min_f)
+			min_f = f;
 	}
+
+	if (n_children > 0) {
+		f = expand_ordered(sst, g, p, ph, h, dests, sts, n_children);
+		if (f < min_f)
+			min_f = f;
+	}
+
+	/* remember what we learned about p */
+	if (min_f > g + h)
+		h = min_f - g;
+
+	if (use_ttable) {
+		info.generation = sst->generation;
+		info.fsm_state = st.state;
+		info.g = g;
+		info.hval = h > UCHAR_MAX ? UCHAR_MAX : h;
+		ttable_store(sst->ttable, &info, &cp);
+	}
+
+	return (g + h);
+}
+
+/*
+ * A thread searching subtrees of a struct split.  Each thread has its
+ * own search state and path.
+ */
+struct subtree_worker {
+	pthread_t thread;
+	struct search_state sst;
+	struct path path;
+	struct split *split;
+};
+
+/*
+ * Prepare w to search the subtrees of split, starting out with the
+ * search state sst and calling on_solved with payload.
+ */
+static void
+subtree_worker_init(struct subtree_worker *w, const struct search_state *sst,
+    struct split *split, void *payload)
+{
+	w->sst = *sst;
+	w->sst.path = &w->path;
+	w->sst.stop = &split->stop;
+	w->sst.on_solved_payload = payload;
+	w->sst.n_solutions = 0;
+	w->sst.expanded = 0;
+	w->sst.pruned = 0;
+	w->sst.duplicates = 0;
+	w->sst.next_bound = SIZE_MAX;
+	w->split = split;
+}
+
+/*
+ * Search subtrees from w->split until none are left, a limit has been
+ * reached or, unless all solutions are wanted, a solution has been
+ * found.  This function always returns NULL for compatibility with
+ * pthread_create().
+ */
+static void *
+subtree_worker(void *warg)
+{
+	struct subtree_worker *w = warg;
+	struct subtree *sub;
+	struct puzzle p;
+	struct partial_hvals ph;
+	size_t i;
+
+	/* a solution was found or a limit reached, here or elsewhere */
+	if (setjmp(w->sst.finish)) {
+		atomic_store_explicit(&w->split->stop, 1, memory_order_relaxed);
+		return (NULL);
+	}
+
+	for (;;) {
+		i = atomic_fetch_add_explicit(&w->split->next_subtree, 1, memory_order_relaxed);
+		if (i >= w->split->n_subtrees)
+			break;
+
+		sub = w->split->subtrees + i;
+		p = sub->p;
+		ph = sub->ph;
+		memcpy(w->path.moves, sub->path.moves, sub->path.pathlen);
+		expand_node(&w->sst, sub->path.pathlen, &p, sub->st, &ph,
+		    sub->from, sub->parent_h);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add the results of worker w to sst.
+ */
+static void
+merge_worker(struct search_state *sst, const struct subtree_worker *w)
+{
+	if (w->sst.n_solutions > 0)
+		*sst->path = w->path;
+
+	sst->n_solutions += w->sst.n_solutions;
+	sst->expanded += w->sst.expanded;
+	sst->pruned += w->sst.pruned;
+	sst->duplicates += w->sst.duplicates;
+	if (w->sst.next_bound < sst->next_bound)
+		sst->next_bound = w->sst.next_bound;
+}
+
+static void
+pool_lock(struct ida_pool *pool)
+{
+	int error;
+
+	error = pthread_mutex_lock(&pool->lock);
+	if (error != 0) {
+		fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(error));
+		abort();
+	}
+}
+
+static void
+pool_unlock(struct ida_pool *pool)
+{
+	int error;
+
+	error = pthread_mutex_unlock(&pool->lock);
+	if (error != 0) {
+		fprintf(stderr, "pthread_mutex_unlock: %s\n", strerror(error));
+		abort();
+	}
+}
+
+/*
+ * Open split to the helpers of pool.  sst is the search state for the
+ * helpers to start out with.
+ */
+static void
+pool_publish(struct ida_pool *pool, struct split *split,
+    const struct search_state *sst)
+{
+	split->sst = sst;
+	split->helpers = 0;
+	split->n_solutions = 0;
+	split->expanded = 0;
+	split->pruned = 0;
+	split->duplicates = 0;
+	split->next_bound = SIZE_MAX;
+
+	pool_lock(pool);
+	split->next = pool->splits;
+	pool->splits = split;
+	pthread_cond_broadcast(&pool->cond);
+	pool_unlock(pool);
+}
+
+/*
+ * Close split to the helpers of pool and wait for the helpers still
+ * working on it to finish.
+ */
+static void
+pool_withdraw(struct ida_pool *pool, struct split *split)
+{
+	struct split **link;
+
+	pool_lock(pool);
+	for (link = &pool->splits; *link != split; link = &(*link)->next)
+		;
+
+	*link = split->next;
+	while (split->helpers > 0)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+
+	pool_unlock(pool);
+}
+
+/*
+ * Search the tree below p with search state sst using up to cfg->jobs
+ * threads.  The tree is first expanded until there are enough subtrees
+ * for all threads which then search the subtrees concurrently, each
+ * calling sst->on_solved with its own payload from cfg->payloads.
+ * If cfg->pool is not NULL, idle threads of the pool may join in, too.
+ * Solutions are only ever found at the bound, so none are found while
+ * splitting.  Add the statistics of all threads to sst.  sst->bound
+ * must be at least 2.
+ */
+static void
+search_subtrees(struct search_state *sst, const struct ida_config *cfg,
+    struct puzzle *p, struct fsm_state st, struct partial_hvals *ph)
+{
+	struct split split;
+	struct subtree_worker workers[PDB_MAX_JOBS];
+	int i, jobs, width, n_threads, error;
+
+	jobs = cfg->jobs > PDB_MAX_JOBS ? PDB_MAX_JOBS : cfg->jobs < 1 ? 1 : cfg->jobs;
+	width = cfg->pool != NULL && cfg->pool->jobs > jobs ? cfg->pool->jobs : jobs;
+
+	split.subtrees = NULL;
+	split.cap = 0;
+	sst->split = &split;
+	for (split.depth = 1;; split.depth++) {
+		split.n_subtrees = 0;
+		sst->expanded = 0;
+		sst->pruned = 0;
+		sst->next_bound = SIZE_MAX;
+		expand_node(sst, 0, p, st, ph, -1, 0);
+		if (split.n_subtrees >= SUBTREES_PER_JOB * width || split.depth + 1 >= sst->bound)
+			break;
+	}
+
+	sst->split = NULL;
+	atomic_init(&split.next_subtree, 0);
+	atomic_init(&split.stop, 0);
+
+	for (i = 0; i < jobs; i++)
+		subtree_worker_init(workers + i, sst, &split,
+		    cfg->payloads != NULL ? cfg->payloads[i] : NULL);
+
+	if (cfg->pool != NULL)
+		pool_publish(cfg->pool, &split, sst);
+
+	/* the calling thread is the first worker */
+	for (n_threads = 1; n_threads < jobs; n_threads++) {
+		error = pthread_create(&workers[n_threads].thread, NULL,
+		    subtree_worker, workers + n_threads);
+		if (error != 0) {
+			/* make do with the threads we have */
+			fprintf(stderr, "pthread_create: %s\n", strerror(error));
+			break;
+		}
+	}
+
+	subtree_worker(workers);
+
+	for (i = 1; i < n_threads; i++) {
+		error = pthread_join(workers[i].thread, NULL);
+		if (error != 0) {
+			fprintf(stderr, "pthread_join: %s\n", strerror(error));
+			abort();
+		}
+	}
+
+	/* helpers copy *sst, so withdraw before merging into it */
+	if (cfg->pool != NULL)
+		pool_withdraw(cfg->pool, &split);
+
+	for (i = 0; i < n_threads; i++)
+		merge_worker(sst, workers + i);
+
+	if (cfg->pool != NULL) {
+		if (split.n_solutions > 0)
+			*sst->path = split.path;
+
+		sst->n_solutions += split.n_solutions;
+		sst->expanded += split.expanded;
+		sst->pruned += split.pruned;
+		sst->duplicates += split.duplicates;
+		if (split.next_bound < sst->next_bound)
+			sst->next_bound = split.next_bound;
+	}
+
+	free(split.subtrees);
+}
+
+/*
+ * Initialise pool for helping searches with up to jobs threads.
+ */
+extern void
+ida_pool_init(struct ida_pool *pool, int jobs)
+{
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->splits = NULL;
+	pool->searches = 0;
+	pool->jobs = jobs;
+}
+
+/*
+ * Release the resources associated with pool.
+ */
+extern void
+ida_pool_destroy(struct ida_pool *pool)
+{
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * Announce that the calling thread is about to start a search using
+ * pool or might do so.  Helpers keep waiting for work as long as
+ * such an announcement is in effect.
+ */
+extern void
+ida_pool_enter(struct ida_pool *pool)
+{
+	pool_lock(pool);
+	pool->searches++;
+	pool_unlock(pool);
+}
+
+/*
+ * Withdraw an announcement made with ida_pool_enter().
+ */
+extern void
+ida_pool_leave(struct ida_pool *pool)
+{
+	pool_lock(pool);
+	if (--pool->searches == 0)
+		pthread_cond_broadcast(&pool->cond);
+	pool_unlock(pool);
+}
+
+/*
+ * Help the searches using pool with their rounds until no search is
+ * in progress or announced anymore.  This is meant to be called by
+ * threads that have run out of work of their own.
+ */
+extern void
+ida_pool_help(struct ida_pool *pool)
+{
+	struct subtree_worker w;
+	struct split *split;
+	struct search_state sst;
+
+	pool_lock(pool);
+	for (;;) {
+		for (split = pool->splits; split != NULL; split = split->next)
+			if (atomic_load(&split->next_subtree) < split->n_subtrees
+			    && !atomic_load(&split->stop))
+				break;
+
+		if (split == NULL) {
+			if (pool->searches == 0)
+				break;
+
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		split->helpers++;
+		pool_unlock(pool);
+
+		subtree_worker_init(&w, split->sst, split, NULL);
+		subtree_worker(&w);
+
+		/* merge_worker() wants a search state to merge into */
+		pool_lock(pool);
+		sst.path = &split->path;
+		sst.n_solutions = split->n_solutions;
+		sst.expanded = split->expanded;
+		sst.pruned = split->pruned;
+		sst.duplicates = split->duplicates;
+		sst.next_bound = split->next_bound;
+		merge_worker(&sst, &w);
+		split->n_solutions = sst.n_solutions;
+		split->expanded = sst.expanded;
+		split->pruned = sst.pruned;
+		split->duplicates = sst.duplicates;
+		split->next_bound = sst.next_bound;
+
+		if (--split->helpers == 0)
+			pthread_cond_broadcast(&pool->cond);
+	}
+
+	pool_unlock(pool);
+}
+
+/*
+ * Determine whether a round is searched in parallel by search_subtrees()
+ * with the given configuration.  As on_solved is called concurrently,
+ * each thread needs a payload of its own if on_solved is given.  The
+ * helpers of a pool have no payloads, so rounds are only opened to
+ * them if on_solved is NULL.
+ */
+static int
+is_parallel(const struct ida_config *cfg,
+    void (*on_solved)(const struct path *, void *))
+{
+	if (on_solved != NULL)
+		return (cfg->jobs > 1 && cfg->payloads != NULL && cfg->pool == NULL);
+	else
+		return (cfg->jobs > 1 || cfg->pool != NULL);
 }
 
 /*
  * Use PDB catalogue cat and finite state machine fsm to search for a
  * solution for p with length bound.  Return the number of solutions found.
- * Update bound with the least bound needed to expand extra nodes.
+ * Write the least bound needed to expand extra nodes to next_bound.
  * Write the number of expanded nodes to expanded.  For each solution found,
  * if on_solved is not NULL call on_solved on the solution with
- * payload as the second argument
+ * payload as the second argument.  If limits is not NULL, give up once
+ * one of the limits is reached and set limits->hit.
  */
 static int
 search_to_bound(struct path *path, struct pdb_catalogue *cat,
-    const struct fsm *fsm, const struct puzzle *p, size_t bound,
-    unsigned long long *expanded, void (*on_solved)(const struct path *,
-    void *), void *payload, int flags) {
+    const struct fsm *fsm, const struct ida_config *cfg,
+    struct search_limits *limits, const struct puzzle *p, size_t bound,
+    size_t *next_bound, unsigned long long *expanded,
+    void (*on_solved)(const struct path *, void *), void *payload, int flags) {
 	struct partial_hvals ph;
 	struct puzzle pp;
 	struct search_state sst;
 	struct fsm_state st;
 
+	sst.split = NULL;
+	sst.stop = NULL;
+	sst.limits = limits;
 	sst.cat = cat;
 	sst.fsm = fsm;
+	sst.perimeter = cfg->perimeter;
+	sst.ttable = cfg->ttable;
 	sst.path = path;
 	sst.flags = flags;
 
 	sst.n_solutions = 0;
 	sst.expanded = 0;
 	sst.pruned = 0;
+	sst.duplicates = 0;
+	sst.next_bound = SIZE_MAX;
+	sst.generation = sst.ttable != NULL ? ttable_new_generation(sst.ttable) : 0;
 	sst.bound = bound;
 	sst.on_solved = on_solved;
 	sst.on_solved_payload = payload;
@@ -150,14 +892,21 @@ search_to_bound(struct path *path, struct pdb_catalogue *cat,
 	st = fsm_start_state(zero_location(&pp));
 	catalogue_partial_hvals(&ph, sst.cat, &pp);
 
-	expand_node((struct search_state *)&sst, 0, &pp, st, &ph);
+	if (is_parallel(cfg, on_solved) && bound >= 2)
+		search_subtrees(&sst, cfg, &pp, st, &ph);
+	else
+		expand_node(&sst, 0, &pp, st, &ph, -1, 0);
 
 finish:
 	*expanded = sst.expanded;
+	*next_bound = sst.next_bound;
 
 	if (flags & IDA_VERBOSE)
 		fprintf(stderr, "Finite state machine pruned %llu nodes in previous round.\n", sst.pruned);
 
+	if (flags & IDA_VERBOSE && sst.ttable != NULL)
+		fprintf(stderr, "Transposition table pruned %llu nodes in previous round.\n", sst.duplicates);
+
 	if (sst.n_solutions == 0)
 		path->pathlen = SEARCH_NO_PATH;
 
@@ -211,46 +960,175 @@ verify(const struct puzzle *p, const struct path *path)
  * return the number of nodes expanded.  If f is not NULL, print
  * diagnostic messages to f.  If on_solved is not NULL, call on_solved
  * for each solution found with the solution and payload for arguments.
+ * cfg supplies optional search aids.  If cfg->perimeter is not NULL,
+ * use it as a perimeter around the goal: once the search enters the
+ * perimeter, the exact distance to the goal is used and the search
+ * proceeds along shortest paths only.  Outside the perimeter, the
+ * radius of the perimeter bounds the distance to the goal from below.
+ * If cfg->ttable is not NULL, use it as a transposition table to skip
+ * configurations already searched during the current round and to
+ * carry lower bounds learned in one round over to the next.  If
+ * cfg->budget is positive, give up once the next round is predicted
+ * to exceed a total of cfg->budget seconds of wall-clock time, which
+ * accounts for the threads searching in parallel.  If cfg->stats
+ * is not NULL, store statistics about the search to *cfg->stats.
+ * If cfg->jobs is larger than 1, each round is split into subtrees
+ * searched by cfg->jobs threads.  In this case, on_solved is called
+ * concurrently by these threads with cfg->payloads[i] as the payload
+ * for thread i.  If on_solved is not NULL, cfg->payloads must be
+ * provided, otherwise the search runs on one thread only.  If
+ * cfg->pool is not NULL and on_solved is NULL, rounds are split into
+ * subtrees even for a single thread and idle threads calling
+ * ida_pool_help() on cfg->pool join in.  Unless flags contains
+ * IDA_LAST_FULL, the threads stop as soon as one of them finds a
+ * solution, so node counts vary from run to run.  Once the search is
+ * done and if cfg->merge is not NULL, cfg->merge(payload,
+ * cfg->payloads[i]) is called for each thread in order, so the results
+ * can be gathered.  If flags contains IDA_PERF, hardware events are
+ * counted and, with IDA_VERBOSE, printed per expanded node for each
+ * round.  Threads helping through ida_pool_help() are not counted.
+ * If cfg->node_limit or cfg->time_limit is positive, give up once the
+ * search has expanded that many nodes or taken that many seconds of
+ * wall-clock time.  If cfg->cancel is not NULL, give up once
+ * *cfg->cancel is nonzero.  These limits are checked every
+ * LIMIT_INTERVAL nodes and between rounds.  A search that gives up sets
+ * path->pathlen = SEARCH_NO_PATH and, if cfg->stats is not NULL, sets
+ * cfg->stats->limited.  The bound then is a proven lower bound for the
+ * solution length.  If cfg->on_round is not NULL, it is called with
+ * cfg->round_payload after each complete round with the bound, node
+ * count, and wall-clock time of the round.
  */
 extern unsigned long long
-search_ida_bounded(struct pdb_catalogue *cat, const struct fsm *fsm,
-    const struct puzzle *p, size_t limit, struct path *path,
-    void (*on_solved)(const struct path *, void *), void *payload, int flags)
+search_ida_config(struct pdb_catalogue *cat, const struct fsm *fsm,
+    const struct ida_config *cfg, const struct puzzle *p, size_t limit,
+    struct path *path, void (*on_solved)(const struct path *, void *),
+    void *payload, int flags)
 {
 	struct timespec begin, round_begin, round_end, duration;
-	unsigned long long expanded, total_expanded = 0;
-	double dur;
-	size_t bound;
-	int n_solution = 0, no_clocks = 0;
+	struct ida_stats stats;
+	struct ida_round round;
+	struct perf_counters counters;
+	struct perf_values perf_begin, perf_round, perf_now;
+	struct search_limits limits, *plimits = NULL;
+	unsigned long long expanded, prev_expanded = 0;
+	double dur = 0.0, growth;
+	size_t bound, next_bound;
+	int i, n_solution = 0, no_clocks = 0, towards, use_perf = 0;
 
-	if (~flags & IDA_VERBOSE)
+	limits.node_limit = cfg->node_limit;
+	limits.cancel = cfg->cancel;
+	limits.use_deadline = 0;
+	atomic_init(&limits.expanded, 0);
+	atomic_init(&limits.hit, 0);
+	if (cfg->time_limit > 0.0) {
+		if (clock_gettime(CLOCK_MONOTONIC, &limits.deadline) == 0) {
+			limits.deadline.tv_sec += (time_t)cfg->time_limit;
+			limits.deadline.tv_nsec += (long)((cfg->time_limit
+			    - (time_t)cfg->time_limit) * 1000000000.0);
+			if (limits.deadline.tv_nsec >= 1000000000) {
+				limits.deadline.tv_sec++;
+				limits.deadline.tv_nsec -= 1000000000;
+			}
+
+			limits.use_deadline = 1;
+		} else
+			perror("clock_gettime");
+	}
+
+	if (limits.node_limit > 0 || limits.cancel != NULL || limits.use_deadline)
+		plimits = &limits;
+
+	if (~flags & IDA_VERBOSE && cfg->budget <= 0.0 && cfg->stats == NULL
+	    && cfg->on_round == NULL)
 		no_clocks = 1;
-	else if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin) != 0) {
+	else if (clock_gettime(CLOCK_MONOTONIC, &begin) != 0) {
 		perror("clock_gettime");
 		no_clocks = 1;
 	} else
 		round_end = begin;
 
+	if (flags & IDA_PERF) {
+		if (perf_open(&counters) == 0) {
+			use_perf = 1;
+			perf_read(&perf_begin, &counters);
+			perf_round = perf_begin;
+		} else if (flags & IDA_VERBOSE)
+			perror("perf_open");
+	}
+
+	memset(&stats, 0, sizeof stats);
 	path->pathlen = SEARCH_NO_PATH;
-	for (bound = catalogue_hval(cat, p); n_solution == 0 && bound <= limit; bound += 2) {
+	bound = perimeter_hval(cfg->perimeter, p, catalogue_hval(cat, p), &towards);
+	for (; n_solution == 0 && bound <= limit; bound = next_bound) {
+		/* all rounds so far are complete, so bound is proven */
+		if (plimits != NULL) {
+			if (limits_reached(plimits, stats.expanded))
+				atomic_store(&plimits->hit, 1);
+
+			if (atomic_load(&plimits->hit))
+				break;
+
+			atomic_store(&plimits->expanded, stats.expanded);
+		}
+
 		if (flags & IDA_VERBOSE)
 			fprintf(stderr, "Searching for solution with bound %zu\n", bound);
 
-		n_solution = search_to_bound(path, cat, fsm, p, bound, &expanded, on_solved, payload, flags);
-		total_expanded += expanded;
+		next_bound = bound + 2;
+		n_solution = search_to_bound(path, cat, fsm, cfg, plimits, p, bound,
+		    &next_bound, &expanded, on_solved, payload, flags);
+		stats.expanded += expanded;
 
-		if (flags & IDA_VERBOSE)
+		if (use_perf) {
+			perf_read(&perf_now, &counters);
+			perf_diff(&stats.perf, &perf_round, &perf_now);
+			perf_round = perf_now;
+		}
+
+		/* the round was cut short, so bound is not exceeded yet */
+		if (n_solution == 0 && plimits != NULL && atomic_load(&plimits->hit))
+			break;
+
+		/*
+		 * Jump straight to the least f value exceeding the bound,
+		 * but keep the parity of the bound, so the solution
+		 * is not skipped.
+		 */
+		if (next_bound < bound + 2)
+			next_bound = bound + 2;
+		else if (next_bound != SIZE_MAX)
+			next_bound += next_bound - bound & 1;
+
+		if (flags & IDA_VERBOSE) {
 			fprintf(stderr, "Expanded %llu nodes during previous round.\n", expanded);
+			if (n_solution == 0 && next_bound == SIZE_MAX)
+				fprintf(stderr, "No node exceeds the bound, search space exhausted.\n");
+			else if (n_solution == 0 && next_bound > bound + 2)
+				fprintf(stderr, "Skipping to bound %zu.\n", next_bound);
+		}
+
+		/*
+		 * Predict the cost of the next round from the growth of
+		 * the node count between the last two rounds, applied
+		 * once for every step of 2 the bound is increased by.
+		 * Until two rounds are known, assume that the tree grows
+		 * by B^2 per step as it does for the brute-force tree.
+		 * If no node exceeded the bound, there is no next round.
+		 */
+		growth = prev_expanded > 0 && expanded > prev_expanded
+		    ? (double)expanded / prev_expanded : B * B;
+		prev_expanded = expanded;
+		if (next_bound == SIZE_MAX)
+			stats.predicted_nodes = 0.0;
+		else
+			stats.predicted_nodes = expanded * pow(growth, (next_bound - bound) / 2);
 
 		if (no_clocks)
 			continue;
 
 		round_begin = round_end;
 
-		if (no_clocks)
-			continue;
-
-		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &round_end) != 0) {
+		if (clock_gettime(CLOCK_MONOTONIC, &round_end) != 0) {
 			perror("clock_gettime");
 			no_clocks = 1;
 			continue;
@@ -258,23 +1136,85 @@ search_ida_bounded(struct pdb_catalogue *cat, const struct fsm *fsm,
 
 		duration = timediff(round_begin, round_end);
 		dur = duration.tv_sec + duration.tv_nsec / 1000000000.0;
-		fprintf(stderr, "Spent %.3f seconds computing the last round, %.2f nodes/s\n",
-		    dur, expanded / dur);
+		duration = timediff(begin, round_end);
+		stats.seconds = duration.tv_sec + duration.tv_nsec / 1000000000.0;
+		stats.predicted_seconds = stats.predicted_nodes * (stats.seconds / stats.expanded);
+
+		if (cfg->on_round != NULL) {
+			round.bound = bound;
+			round.expanded = expanded;
+			round.seconds = dur;
+			cfg->on_round(&round, cfg->round_payload);
+		}
+
+		if (flags & IDA_VERBOSE) {
+			fprintf(stderr, "Spent %.3f seconds computing the last round, %.2f nodes/s\n",
+			    dur, expanded / dur);
+
+			if (use_perf) {
+				fprintf(stderr, "Counted ");
+				perf_print(stderr, &stats.perf, expanded);
+				fprintf(stderr, " in the last round.\n");
+			}
+
+			if (n_solution == 0 && next_bound != SIZE_MAX)
+				fprintf(stderr, "Predicting %.0f nodes and %.3f seconds for the next round.\n",
+				    stats.predicted_nodes, stats.predicted_seconds);
+		}
+
+		/* stop if the next round is not going to fit into the budget */
+		if (n_solution == 0 && cfg->budget > 0.0
+		    && stats.seconds + stats.predicted_seconds > cfg->budget) {
+			stats.out_of_budget = 1;
+
+			if (flags & IDA_VERBOSE)
+				fprintf(stderr, "Next round exceeds budget of %.3f seconds, giving up.\n",
+				    cfg->budget);
+
+			bound = next_bound;
+			break;
+		}
+	}
+
+	if (use_perf) {
+		perf_diff(&stats.perf, &perf_begin, &perf_round);
+		perf_close(&counters);
+	}
+
+	if (n_solution == 0 && plimits != NULL && atomic_load(&plimits->hit)) {
+		stats.limited = 1;
+
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Search limit reached or search cancelled, giving up.\n");
+
+		/* account for the round cut short */
+		if (!no_clocks && clock_gettime(CLOCK_MONOTONIC, &round_end) == 0) {
+			duration = timediff(begin, round_end);
+			stats.seconds = duration.tv_sec + duration.tv_nsec / 1000000000.0;
+		}
 	}
 
+	/* if a solution was found, the loop has advanced bound past it */
+	stats.bound = n_solution > 0 ? path->pathlen : bound;
+	stats.lower_bound = stats.bound;
+
 	if (flags & IDA_VERBOSE) {
-		fprintf(stderr, "Expanded %llu nodes in total.\n", total_expanded);
+		fprintf(stderr, "Expanded %llu nodes in total.\n", stats.expanded);
 		if (n_solution > 0)
 			fprintf(stderr, "Found %d solution(s).\n", n_solution);
 		else
-			fprintf(stderr, "No solution found.\n");
+			fprintf(stderr, "No solution found, solution has at least %zu moves.\n",
+			    stats.bound);
 	}
 
-	if (!no_clocks) {
-		duration = timediff(begin, round_end);
-		dur = duration.tv_sec + duration.tv_nsec / 1000000000.0;
+	if (flags & IDA_VERBOSE && !no_clocks)
 		fprintf(stderr, "Spent %.3f seconds in total, %.2f nodes/s\n",
-		    dur, total_expanded / dur);
+		    stats.seconds, stats.expanded / stats.seconds);
+
+	if (flags & IDA_VERBOSE && use_perf) {
+		fprintf(stderr, "Counted ");
+		perf_print(stderr, &stats.perf, stats.expanded);
+		fprintf(stderr, " in total.\n");
 	}
 
 	if (flags & IDA_VERIFY && !verify(p, path)) {
@@ -284,7 +1224,27 @@ search_ida_bounded(struct pdb_catalogue *cat, const struct fsm *fsm,
 		abort();
 	}
 
-	return (total_expanded);
+	if (cfg->stats != NULL)
+		*cfg->stats = stats;
+
+	if (is_parallel(cfg, on_solved) && cfg->merge != NULL)
+		for (i = 0; i < cfg->jobs && i < PDB_MAX_JOBS; i++)
+			cfg->merge(payload, cfg->payloads[i]);
+
+	return (stats.expanded);
+}
+
+/*
+ * Run search_ida_config without any search aids.
+ */
+extern unsigned long long
+search_ida_bounded(struct pdb_catalogue *cat, const struct fsm *fsm,
+    const struct puzzle *p, size_t limit, struct path *path,
+    void (*on_solved)(const struct path *, void *), void *payload, int flags)
+{
+	struct ida_config cfg = { 0 };
+
+	return (search_ida_config(cat, fsm, &cfg, p, limit, path, on_solved, payload, flags));
 }
 
 /*
@@ -27,6 +27,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,6 +37,7 @@
 #include "match.h"
 #include "tileset.h"
 #include "heuristic.h"
+#include "pdb.h"
 #include "puzzle.h"
 #include "transposition.h"
 
@@ -56,9 +59,9 @@ enum {
 	SIX_OF_TWELVE = 924, /* 12 choose 6 */
 };
 
-static int	match_half_best(const unsigned char[MATCH_SIZE],
+static void	match_half_best(const unsigned char[MATCH_SIZE],
     const struct quality[MATCH_SIZE], tileset, tileset[2],
-    unsigned long long *, unsigned long long *);
+    unsigned long long *, unsigned long long *, int *);
 
 /*
  * Load a quality vector from qualityfile.  On success, return a
@@ -135,109 +138,352 @@ fail2:	free(qualities);
 	return (NULL);
 }
 
+/*
+ * Tables to quickly rank the quarters of a half.  tileset_rank() ranks
+ * tile sets in colexicographic order, so the rank of a six tile set
+ * with tiles t_0 < t_1 < ... < t_5 is binom[t_0][1] + binom[t_1][2] +
+ * ... + binom[t_5][6].  We split the twelve tiles of a half into the
+ * six lower and the six upper tiles.  Split i of a half places the
+ * lower tiles selected by the bit mask split_lower[i] and the upper
+ * tiles selected by split_upper[i] into the low quarter, the remaining
+ * tiles go into the high quarter.  The rank of a quarter is then the
+ * sum of a term depending only on its lower tiles and a term depending
+ * only on its upper tiles, both of which are tabulated once per half.
+ */
+enum { HALF_SPLITS = SIX_OF_TWELVE / 2 };
+
+static tsrank binom[TILE_COUNT][7];
+static unsigned char split_lower[HALF_SPLITS], split_upper[HALF_SPLITS];
+static pthread_once_t match_tables_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Initialise binom, split_lower, and split_upper.
+ */
+static void
+match_tables_init(void)
+{
+	size_t i, j;
+	tileset lo;
+
+	for (i = 0; i < TILE_COUNT; i++) {
+		binom[i][0] = 1;
+		for (j = 1; j < 7; j++)
+			binom[i][j] = i == 0 ? 0 : binom[i - 1][j - 1] + binom[i - 1][j];
+	}
+
+	tileset_unrank_init(6);
+	tileset_unrank_init(12);
+
+	for (i = 0; i < HALF_SPLITS; i++) {
+		lo = tileset_unrank(6, i);
+		split_lower[i] = lo & 077;
+		split_upper[i] = lo >> 6;
+	}
+}
+
+/*
+ * Fill in the partial rank tables for half.  Partial ranks for subsets
+ * of the lower tiles of half are stored in lower, those for subsets of
+ * the upper tiles are stored in upper.  The tiles in upper are counted
+ * from the top as the number of lower tiles in a quarter is six minus
+ * the number of upper tiles.
+ */
+static void
+half_rank_tables(tsrank lower[64], tsrank upper[64], tileset half)
+{
+	size_t i, j;
+	unsigned tiles[12];
+	tileset t;
+
+	/* ranks are computed without the zero tile, see tileset_ranknz() */
+	for (t = half >> 1, i = 0; i < 12; t = tileset_remove_least(t), i++)
+		tiles[i] = tileset_get_least(t);
+
+	/* add the highest tile to a subset of the tiles below it */
+	lower[0] = 0;
+	for (j = 0; j < 6; j++)
+		for (i = 1 << j; i < 2 << j; i++)
+			lower[i] = lower[i - (1 << j)] + binom[tiles[j]][popcount(i)];
+
+	/* add the lowest tile to a subset of the tiles above it */
+	upper[0] = 0;
+	for (i = 1; i < 64; i++)
+		upper[i] = upper[i & i - 1] + binom[tiles[6 + ctz(i)]][7 - popcount(i)];
+}
+
+/*
+ * The result of matching a range of halves.  The members have the
+ * same meaning as in struct match, max is the h value found.
+ */
+struct match_result {
+	unsigned long long count, quality;
+	tileset quarters[4];
+	int max;
+};
+
+/*
+ * Configuration for match_worker.  The halves are processed in chunks
+ * of MATCH_CHUNK halves, the result for each chunk is stored in
+ * results so they can be merged in order.  best is the highest h value
+ * found by any thread so far and is used to skip halves that cannot
+ * reach it.  vmax is the highest entry in matchv.
+ */
+enum { MATCH_CHUNK = 4096 };
+
+struct match_config {
+	const unsigned char *matchv;
+	const struct quality *qualities;
+	struct match_result *results;
+	_Atomic size_t next_chunk;
+	_Atomic int best;
+	int vmax;
+};
+
+/*
+ * Merge result r into the accumulated result acc.  Merging results for
+ * consecutive ranges of halves in order yields the same result as if
+ * the halves had been processed in one go.
+ */
+static void
+merge_result(struct match_result *restrict acc, const struct match_result *restrict r)
+{
+	if (r->count == 0)
+		return;
+
+	if (r->max > acc->max) {
+		acc->max = r->max;
+		acc->count = 0;
+		acc->quality = 0;
+	}
+
+	if (r->max == acc->max) {
+		acc->count += r->count;
+
+		if (r->quality >= acc->quality) {
+			acc->quality = r->quality;
+			memcpy(acc->quarters, r->quarters, sizeof acc->quarters);
+		}
+	}
+}
+
+/*
+ * Raise cfg->best to max if it is lower.
+ */
+static void
+raise_best(struct match_config *cfg, int max)
+{
+	int best = atomic_load_explicit(&cfg->best, memory_order_relaxed);
+
+	while (best < max && !atomic_compare_exchange_weak_explicit(&cfg->best,
+	    &best, max, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+/*
+ * Match halves first to first + n - 1 and store the result to r.
+ * A half is skipped if it cannot reach the best h value found so far
+ * by any thread, even if its second half was as good as possible.
+ */
+static void
+match_range(struct match_config *cfg, struct match_result *r, size_t first, size_t n)
+{
+	struct match_result lo, hi, half_result;
+	size_t i;
+	tileset half;
+
+	r->max = 0;
+	r->count = 0;
+	r->quality = 0;
+
+	for (i = first; i < first + n; i++) {
+		half = tileset_unranknz(12, i);
+		match_half_best(cfg->matchv, cfg->qualities, half, lo.quarters, &lo.count, &lo.quality, &lo.max);
+		assert(lo.count != 0);
+		if (lo.max + 2 * cfg->vmax < atomic_load_explicit(&cfg->best, memory_order_relaxed))
+			continue;
+
+		match_half_best(cfg->matchv, cfg->qualities,
+		    tileset_difference(NONZERO_TILES, half), hi.quarters, &hi.count, &hi.quality, &hi.max);
+		assert(hi.count != 0);
+
+		half_result.max = lo.max + hi.max;
+		half_result.count = lo.count * hi.count;
+		half_result.quality = lo.quality + hi.quality;
+		half_result.quarters[0] = lo.quarters[0];
+		half_result.quarters[1] = lo.quarters[1];
+		half_result.quarters[2] = hi.quarters[0];
+		half_result.quarters[3] = hi.quarters[1];
+
+		if (half_result.max > r->max)
+			raise_best(cfg, half_result.max);
+
+		merge_result(r, &half_result);
+	}
+}
+
+/*
+ * Process chunks of halves until none are left.
+ */
+static void *
+match_worker(void *cfgarg)
+{
+	struct match_config *cfg = cfgarg;
+	size_t chunk, n, n_chunk = (TWELVE_TILES / 2 + MATCH_CHUNK - 1) / MATCH_CHUNK;
+
+	while (chunk = atomic_fetch_add(&cfg->next_chunk, 1), chunk < n_chunk) {
+		n = TWELVE_TILES / 2 - chunk * MATCH_CHUNK;
+		if (n > MATCH_CHUNK)
+			n = MATCH_CHUNK;
+
+		match_range(cfg, cfg->results + chunk, chunk * MATCH_CHUNK, n);
+	}
+
+	return (NULL);
+}
+
 /*
  * Find the best way to partition the tray into 4 groups of six tiles
  * and store the optimal matches in match.  The best partitioning is the
  * partitioning with the highest possible h value for the configuration
  * whose partial h values are given in match with the best quality as
- * indicated by the qualities vector.  On success return 1,  on error,
- * return 0 and set errno to indicate a reason.
+ * indicated by the qualities vector.  The halves are distributed over
+ * pdb_jobs threads.  On success return 1,  on error, return 0 and set
+ * errno to indicate a reason.
  */
 extern int
 match_find_best(struct match *match, const unsigned char matchv[MATCH_SIZE],
     const struct quality qualities[MATCH_SIZE])
 {
-	unsigned long long locount, hicount, loqual, hiqual;
-	size_t i, j;
-	tileset half, quarters[4];
-	int max, hlo, hhi;
+	struct match_config cfg;
+	struct match_result acc;
+	pthread_t pool[PDB_MAX_JOBS];
+	size_t i, n_chunk = (TWELVE_TILES / 2 + MATCH_CHUNK - 1) / MATCH_CHUNK;
+	int j, jobs = pdb_jobs, error;
+
+	pthread_once(&match_tables_once, match_tables_init);
+
+	cfg.matchv = matchv;
+	cfg.qualities = qualities;
+	cfg.next_chunk = 0;
+	cfg.best = 0;
+	cfg.vmax = 0;
+	for (i = 0; i < MATCH_SIZE; i++)
+		if (matchv[i] > cfg.vmax)
+			cfg.vmax = matchv[i];
+
+	cfg.results = malloc(n_chunk * sizeof *cfg.results);
+	if (cfg.results == NULL)
+		return (0);
+
+	/* for easier debugging, don't multithread when jobs == 1 */
+	if (jobs == 1)
+		match_worker(&cfg);
+	else {
+		for (j = 0; j < jobs; j++) {
+			error = pthread_create(pool + j, NULL, match_worker, &cfg);
+			if (error == 0)
+				continue;
 
-	tileset_unrank_init(6);
-	tileset_unrank_init(12);
+			/* make do with the threads we have if any */
+			if (j > 0)
+				break;
 
-	memset(match, 0, sizeof *match);
+			free(cfg.results);
+			errno = error;
+			return (0);
+		}
 
-	max = 0;
-	for (i = 0; i < TWELVE_TILES / 2; i++) {
-		half = tileset_unranknz(12, i);
-		hlo = match_half_best(matchv, qualities, half, quarters, &locount, &loqual);
-		hhi = match_half_best(matchv, qualities,
-		    tileset_difference(NONZERO_TILES, half), quarters + 2, &hicount, &hiqual);
-		assert(locount != 0);
-		assert(hicount != 0);
-		if (hlo + hhi > max) {
-			max = hlo + hhi;
-			match->count = 0;
-			match->quality = 0;
+		jobs = j;
+		for (j = 0; j < jobs; j++) {
+			error = pthread_join(pool[j], NULL);
+			if (error == 0)
+				continue;
+
+			errno = error;
+			perror("pthread_join");
+			abort();
 		}
+	}
 
-		if (hlo + hhi >= max) {
-			match->count += locount * hicount;
+	acc.max = 0;
+	acc.count = 0;
+	acc.quality = 0;
+	for (i = 0; i < n_chunk; i++)
+		merge_result(&acc, cfg.results + i);
 
-			if (loqual + hiqual >= match->quality) {
-				match->quality = loqual + hiqual;
+	free(cfg.results);
 
-				for (j = 0; j < 4; j++) {
-					match->ts[j] = quarters[j];
-					match->hval[j] = matchv[tileset_ranknz(quarters[j])];
-				}
-			}
-		}
+	memset(match, 0, sizeof *match);
+	match->quality = acc.quality;
+	for (j = 0; j < 4; j++) {
+		match->ts[j] = acc.quarters[j];
+		match->hval[j] = matchv[tileset_ranknz(acc.quarters[j])];
 	}
 
 	/* each partitioning was tried twice, account for this in count */
-	match->count /= 2;
+	match->count = acc.count / 2;
 
 	return (1);
 }
 
 /*
- * Try all ways to match the given half into two quarters.  Return the
- * highest h value found, store one partitioning with the highest
+ * Try all ways to match the given half into two quarters.  Store the
+ * highest h value found to max, one partitioning with the highest
  * h value to quarters and the number of partitionings with that h value
  * to count.  The match returned is the highest quality match found.
- * Store the quality of the match in quality.
+ * Store the quality of the match in quality.  The h values of all
+ * splits are computed first so the maximum and the number of splits
+ * attaining it can be found with simple loops the compiler vectorises.
+ * Qualities are only looked up for the splits attaining the maximum.
  */
-static int
+static void
 match_half_best(const unsigned char matchv[MATCH_SIZE],
     const struct quality qualities[MATCH_SIZE], tileset half,
-    tileset quarters[2], unsigned long long *count, unsigned long long *maxqual)
+    tileset quarters[2], unsigned long long *count, unsigned long long *maxqual,
+    int *maxp)
 {
 	unsigned long long quality;
-	size_t i;
-	tileset loquarter, hiquarter;
-	tsrank lorank, hirank;
-	int max = 0, hval;
-
-	*count = 0;
-	*maxqual = 0;
+	size_t i, best = 0;
+	tsrank lower[64], upper[64];
+	unsigned short hvals[HALF_SPLITS];
+	unsigned max = 0, n = 0, lo, up;
+
+	half_rank_tables(lower, upper, half);
+
+	for (i = 0; i < HALF_SPLITS; i++) {
+		lo = split_lower[i];
+		up = split_upper[i];
+		hvals[i] = matchv[lower[lo] + upper[up]]
+		    + matchv[lower[lo ^ 077] + upper[up ^ 077]];
+	}
 
-	for (i = 0; i < SIX_OF_TWELVE / 2; i++) {
-		loquarter = pdep(half, tileset_unrank(6, i));
-		hiquarter = tileset_difference(half, loquarter);
+	for (i = 0; i < HALF_SPLITS; i++)
+		if (hvals[i] > max)
+			max = hvals[i];
 
-		lorank = tileset_ranknz(loquarter);
-		hirank = tileset_ranknz(hiquarter);
+	for (i = 0; i < HALF_SPLITS; i++)
+		n += hvals[i] == max;
 
-		hval = matchv[lorank] + matchv[hirank];
-		quality = qualities[lorank].havg + qualities[hirank].havg;
+	*maxp = max;
+	*count = n;
+	*maxqual = 0;
 
-		if (hval > max) {
-			max = hval;
-			*count = 0;
-			*maxqual = 0;
-		}
+	for (i = 0; i < HALF_SPLITS; i++) {
+		if (hvals[i] != max)
+			continue;
 
-		if (hval >= max) {
-			++*count;
+		quarters[0] = pdep(half, tileset_unrank(6, i));
+		quarters[1] = tileset_difference(half, quarters[0]);
+		quality = qualities[tileset_ranknz(quarters[0])].havg
+		    + qualities[tileset_ranknz(quarters[1])].havg;
 
-			if (quality >= *maxqual) {
-				quarters[0] = loquarter;
-				quarters[1] = hiquarter;
-				*maxqual = quality;
-			}
+		/* keep the last split with the highest quality */
+		if (quality >= *maxqual) {
+			*maxqual = quality;
+			best = i;
 		}
 	}
 
-	return (max);
+	quarters[0] = pdep(half, tileset_unrank(6, best));
+	quarters[1] = tileset_difference(half, quarters[0]);
 }
@@ -0,0 +1,252 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* matchfile.c -- memory mapped match vector files */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "compact.h"
+#include "match.h"
+#include "matchfile.h"
+#include "pdb.h"
+
+/* the page size we align the match vectors to */
+enum { PAGE_SIZE = 4096 };
+
+/*
+ * The header of a match file.  match_size is recorded so files made
+ * for a different MATCH_SIZE are rejected.
+ */
+struct matchfile_header {
+	char magic[8];
+	unsigned long long n_puzzle, match_size;
+};
+
+static const char matchfile_magic[8] = "24PMATCH";
+
+/*
+ * Compute the offset of the done map and of the match vectors in a
+ * match file for n_puzzle puzzles.  Return the total file length.
+ */
+static size_t
+matchfile_layout(size_t *done_offset, size_t *vectors_offset, size_t n_puzzle)
+{
+	*done_offset = sizeof(struct matchfile_header)
+	    + n_puzzle * sizeof(struct compact_puzzle);
+	*vectors_offset = (*done_offset + MATCH_SIZE + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+	return (*vectors_offset + n_puzzle * MATCH_SIZE);
+}
+
+/*
+ * Fill in the header and puzzles of a fresh match file at base and
+ * mark all entries as not yet filled in.
+ */
+static void
+matchfile_init(unsigned char *base, size_t done_offset, size_t vectors_offset,
+    const struct puzzle *puzzles, size_t n_puzzle)
+{
+	struct matchfile_header header;
+	struct compact_puzzle cp;
+	size_t i;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, matchfile_magic, sizeof header.magic);
+	header.n_puzzle = n_puzzle;
+	header.match_size = MATCH_SIZE;
+
+	for (i = 0; i < n_puzzle; i++) {
+		pack_puzzle(&cp, puzzles + i);
+		memcpy(base + sizeof header + i * sizeof cp, &cp, sizeof cp);
+	}
+
+	memset(base + done_offset, 0, MATCH_SIZE);
+	memset(base + vectors_offset, UNREACHED, n_puzzle * MATCH_SIZE);
+
+	/* write the header last so a partially initialised file is rejected */
+	memcpy(base, &header, sizeof header);
+}
+
+/*
+ * Check if the match file at base was made for puzzles.  Return 1 if
+ * it was, 0 if it was not.
+ */
+static int
+matchfile_matches(const unsigned char *base, const struct puzzle *puzzles,
+    size_t n_puzzle)
+{
+	struct matchfile_header header;
+	struct compact_puzzle cp;
+	size_t i;
+
+	memcpy(&header, base, sizeof header);
+	if (memcmp(header.magic, matchfile_magic, sizeof header.magic) != 0
+	    || header.n_puzzle != n_puzzle || header.match_size != MATCH_SIZE)
+		return (0);
+
+	for (i = 0; i < n_puzzle; i++) {
+		pack_puzzle(&cp, puzzles + i);
+		if (memcmp(base + sizeof header + i * sizeof cp, &cp, sizeof cp) != 0)
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Open the match file filename for the n_puzzle puzzles in puzzles and
+ * map it into memory.  If MATCHFILE_CREATE is set in flags and the file
+ * does not exist or is empty, create it with all entries not filled in.
+ * If filename is NULL, allocate a match file in memory instead.  On
+ * success, fill in mf and return 0.  On failure, set errno and return
+ * -1.  A file made for different puzzles is rejected with EINVAL.
+ */
+extern int
+matchfile_open(struct match_file *mf, const char *filename,
+    const struct puzzle *puzzles, size_t n_puzzle, int flags)
+{
+	struct stat st;
+	size_t done_offset, vectors_offset, len;
+	void *base;
+	int fd, error, fresh;
+
+	len = matchfile_layout(&done_offset, &vectors_offset, n_puzzle);
+
+	if (filename == NULL) {
+		base = malloc(len);
+		if (base == NULL)
+			return (-1);
+
+		matchfile_init(base, done_offset, vectors_offset, puzzles, n_puzzle);
+		mf->len = 0;
+		goto success;
+	}
+
+	fd = open(filename, flags & MATCHFILE_CREATE ? O_RDWR | O_CREAT : O_RDWR, 0666);
+	if (fd == -1)
+		return (-1);
+
+	if (fstat(fd, &st) == -1)
+		goto fail;
+
+	fresh = st.st_size == 0;
+	if (fresh) {
+		if (!(flags & MATCHFILE_CREATE)) {
+			errno = EINVAL;
+			goto fail;
+		}
+
+		if (ftruncate(fd, (off_t)len) == -1)
+			goto fail;
+	} else if ((size_t)st.st_size != len) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		goto fail;
+
+	close(fd);
+
+	if (fresh)
+		matchfile_init(base, done_offset, vectors_offset, puzzles, n_puzzle);
+	else if (!matchfile_matches(base, puzzles, n_puzzle)) {
+		munmap(base, len);
+		errno = EINVAL;
+		return (-1);
+	}
+
+	mf->len = len;
+
+success:
+	mf->base = base;
+	mf->done = (unsigned char *)base + done_offset;
+	mf->vectors = (unsigned char *)base + vectors_offset;
+	mf->n_puzzle = n_puzzle;
+
+	return (0);
+
+fail:
+	error = errno;
+	close(fd);
+	errno = error;
+
+	return (-1);
+}
+
+/*
+ * Write the changes to a mapped match file back to disk and wait for
+ * the write to complete.  Do nothing for a match file kept in memory.
+ * Return 0 on success, set errno and return -1 on failure.
+ */
+extern int
+matchfile_sync(const struct match_file *mf)
+{
+	if (mf->len == 0)
+		return (0);
+
+	return (msync(mf->base, mf->len, MS_SYNC));
+}
+
+/*
+ * Release the mapping or storage associated with mf.  Changes to a
+ * mapped match file are written back to disk.
+ */
+extern void
+matchfile_close(struct match_file *mf)
+{
+	if (mf->len != 0) {
+		if (matchfile_sync(mf) != 0)
+			perror("matchfile_sync");
+
+		munmap(mf->base, mf->len);
+	} else
+		free(mf->base);
+}
+
+/*
+ * Return 1 if all entries in mf have been filled in, 0 otherwise.
+ */
+extern int
+matchfile_complete(const struct match_file *mf)
+{
+	size_t i;
+
+	for (i = 0; i < MATCH_SIZE; i++)
+		if (!mf->done[i])
+			return (0);
+
+	return (1);
+}
@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* matchfile.h -- memory mapped match vector files */
+
+#ifndef MATCHFILE_H
+#define MATCHFILE_H
+
+#include <stddef.h>
+
+#include "match.h"
+#include "puzzle.h"
+
+/*
+ * A match file holds the match vectors for a set of puzzles as used by
+ * pdbmatch.  The file begins with a header identifying the file type,
+ * followed by the puzzles the vectors belong to in compact form, the
+ * done map, and, aligned to a page boundary, one match vector of
+ * MATCH_SIZE bytes per puzzle.  done[rank] is set once entry rank
+ * has been filled in for all puzzles and written back with
+ * matchfile_sync(), allowing an interrupted run to resume where it
+ * left off.  As match_find_best() consumes one whole
+ * match vector at a time, the vectors are stored contiguously and can
+ * be used straight out of the mapping.  If no file name is given to
+ * matchfile_open(), the match file is kept in memory only.
+ */
+struct match_file {
+	unsigned char *vectors;	/* n_puzzle match vectors */
+	unsigned char *done;	/* MATCH_SIZE flags */
+	void *base;		/* start of the mapping or allocation */
+	size_t len;		/* length of the mapping, 0 if allocated */
+	size_t n_puzzle;	/* number of match vectors */
+};
+
+/* flags for matchfile_open() */
+enum {
+	MATCHFILE_CREATE = 1 << 0,	/* create the file if not present */
+};
+
+extern int	matchfile_open(struct match_file *, const char *,
+    const struct puzzle *, size_t, int);
+extern int	matchfile_sync(const struct match_file *);
+extern void	matchfile_close(struct match_file *);
+extern int	matchfile_complete(const struct match_file *);
+
+/*
+ * Return the match vector for puzzle i in mf.
+ */
+static inline unsigned char *
+matchfile_vector(const struct match_file *mf, size_t i)
+{
+	return (mf->vectors + i * MATCH_SIZE);
+}
+
+#endif /* MATCHFILE_H */
@@ -98,6 +98,7 @@ extern int	pdb_verify(struct patterndb *, FILE *);
 extern void	pdb_identify(struct patterndb *);
 
 /* quality.c */
+extern void	pdb_quality(struct patterndb *, double *, double *);
 extern double	pdb_eta(struct patterndb *);
 extern double	pdb_h_average(struct patterndb *);
 
@@ -0,0 +1,230 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* perfcount.c -- hardware performance counters */
+
+/*
+ * The counters are read through the perf_event_open() system call of
+ * Linux.  On other systems, or if the kernel does not permit access to
+ * the counters, perf_open() fails and no events are counted.  Only
+ * user space events are counted, so a perf_event_paranoid setting of
+ * up to 2 is sufficient.  If there are more events than hardware
+ * counters, the kernel multiplexes the events onto the counters, so
+ * each event is only counted part of the time.  perf_diff() scales the
+ * counts up by the time each event was enabled over the time it was
+ * counted.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perfcount.h"
+
+/* the names of the events for perf_print(), per node */
+static const char *const event_names[PERF_EVENT_COUNT] = {
+	"cycles",
+	"instructions",
+	"LLC misses",
+	"dTLB misses",
+	"branch misses",
+};
+
+#ifdef __linux__
+/* perf_event_open() type and config for each event */
+static const struct {
+	unsigned type;
+	unsigned long long config;
+} events[PERF_EVENT_COUNT] = {
+	PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+	PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+	PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+	    | PERF_COUNT_HW_CACHE_OP_READ << 8
+	    | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+	PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+};
+#endif
+
+/*
+ * Open counters for all events in pc, counting the calling thread and
+ * the threads it creates from now on.  Return 0 if at least one event
+ * can be counted.  Otherwise, return -1 and set errno to indicate the
+ * error encountered opening the first event.
+ */
+extern int
+perf_open(struct perf_counters *pc)
+{
+	int i, error = ENOSYS, n_open = 0;
+
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	for (i = 0; i < PERF_EVENT_COUNT; i++) {
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+		    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		pc->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fds[i] != -1)
+			n_open++;
+		else if (n_open == 0 && error == ENOSYS)
+			error = errno;
+	}
+#else
+	for (i = 0; i < PERF_EVENT_COUNT; i++)
+		pc->fds[i] = -1;
+#endif
+
+	if (n_open == 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Close the counters in pc.
+ */
+extern void
+perf_close(struct perf_counters *pc)
+{
+	int i;
+
+	for (i = 0; i < PERF_EVENT_COUNT; i++)
+		if (pc->fds[i] != -1)
+			close(pc->fds[i]);
+}
+
+/*
+ * Read the current values of the counters in pc into pv.  Events that
+ * cannot be read are marked as invalid.
+ */
+extern void
+perf_read(struct perf_values *pv, const struct perf_counters *pc)
+{
+	/* value, time enabled, time running */
+	unsigned long long buf[3];
+	int i;
+
+	pv->valid = 0;
+	for (i = 0; i < PERF_EVENT_COUNT; i++) {
+		pv->values[i] = 0;
+		pv->enabled[i] = 0;
+		pv->running[i] = 0;
+		if (pc->fds[i] == -1)
+			continue;
+
+		if (read(pc->fds[i], buf, sizeof buf) != sizeof buf)
+			continue;
+
+		pv->values[i] = buf[0];
+		pv->enabled[i] = buf[1];
+		pv->running[i] = buf[2];
+		pv->valid |= 1 << i;
+	}
+}
+
+/*
+ * Store the difference between the readings end and begin to diff.
+ * The values are scaled to make up for the time the events were not
+ * counted due to multiplexing.  Events that were not counted at all
+ * in between are marked as invalid.
+ */
+extern void
+perf_diff(struct perf_values *diff, const struct perf_values *begin,
+    const struct perf_values *end)
+{
+	unsigned long long value;
+	int i;
+
+	diff->valid = begin->valid & end->valid;
+	for (i = 0; i < PERF_EVENT_COUNT; i++) {
+		diff->values[i] = 0;
+		diff->enabled[i] = 0;
+		diff->running[i] = 0;
+		if (~diff->valid & 1 << i)
+			continue;
+
+		value = end->values[i] - begin->values[i];
+		diff->enabled[i] = end->enabled[i] - begin->enabled[i];
+		diff->running[i] = end->running[i] - begin->running[i];
+		if (diff->running[i] == 0) {
+			diff->valid &= ~(1u << i);
+			continue;
+		}
+
+		if (diff->running[i] < diff->enabled[i])
+			value = (unsigned long long)((double)value
+			    * diff->enabled[i] / diff->running[i] + 0.5);
+
+		diff->values[i] = value;
+	}
+}
+
+/*
+ * Print the events in pv normalised to n nodes to f, without a
+ * trailing newline.  If both cycles and instructions were counted,
+ * also print the instructions per cycle.
+ */
+extern void
+perf_print(FILE *f, const struct perf_values *pv, unsigned long long n)
+{
+	int i, first = 1;
+	const unsigned ipc_mask = 1 << PERF_CYCLES | 1 << PERF_INSTRUCTIONS;
+
+	if (n == 0)
+		n = 1;
+
+	for (i = 0; i < PERF_EVENT_COUNT; i++) {
+		if (~pv->valid & 1 << i)
+			continue;
+
+		fprintf(f, "%s%.2f %s/node", first ? "" : ", ",
+		    (double)pv->values[i] / n, event_names[i]);
+		first = 0;
+	}
+
+	if ((pv->valid & ipc_mask) == ipc_mask && pv->values[PERF_CYCLES] > 0)
+		fprintf(f, ", %.2f IPC",
+		    (double)pv->values[PERF_INSTRUCTIONS] / pv->values[PERF_CYCLES]);
+
+	if (first)
+		fprintf(f, "no counters available");
+}
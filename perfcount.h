@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* perfcount.h -- hardware performance counters */
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdio.h>
+
+/*
+ * The hardware events counted by perf_open().  Not every machine can
+ * count all of them.
+ */
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_EVENT_COUNT,
+};
+
+/*
+ * A set of counters for the events above.  The counters count the
+ * thread that opened them as well as threads created by it once these
+ * have terminated.  Threads created before, such as those helping a
+ * search through ida_pool_help(), are not counted.  Events that cannot
+ * be counted have a file descriptor of -1.
+ */
+struct perf_counters {
+	int fds[PERF_EVENT_COUNT];
+};
+
+/*
+ * Counter values read at some point in time or the difference of two
+ * such readings.  Bit i of valid is set if values[i] holds a value.
+ * enabled[i] and running[i] are the nanoseconds event i was enabled
+ * and actually counted.  The values of a difference are scaled by
+ * enabled[i] / running[i] to make up for the time the event was not
+ * counted.
+ */
+struct perf_values {
+	unsigned long long values[PERF_EVENT_COUNT];
+	unsigned long long enabled[PERF_EVENT_COUNT];
+	unsigned long long running[PERF_EVENT_COUNT];
+	unsigned valid;
+};
+
+extern int	perf_open(struct perf_counters *);
+extern void	perf_close(struct perf_counters *);
+extern void	perf_read(struct perf_values *, const struct perf_counters *);
+extern void	perf_diff(struct perf_values *, const struct perf_values *, const struct perf_values *);
+extern void	perf_print(FILE *, const struct perf_values *, unsigned long long);
+
+#endif /* PERFCOUNT_H */
@@ -0,0 +1,435 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* perimeter.c -- configurations close to the solved configuration */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compact.h"
+#include "perimeter.h"
+#include "puzzle.h"
+
+/*
+ * The header of a perimeter file.  It is followed by the layers of
+ * the perimeter, one after another.
+ */
+struct perimeter_header {
+	char magic[8];
+	unsigned long long radius, len[PERIMETER_MAX_RADIUS + 1];
+};
+
+static const char perimeter_magic[8] = "24PPERIM";
+
+/*
+ * Allocate an empty perimeter of the given radius.  On failure, return
+ * NULL and set errno.
+ */
+static struct perimeter *
+perimeter_allocate(int radius)
+{
+	struct perimeter *per;
+	int d;
+
+	if (radius < 0 || radius > PERIMETER_MAX_RADIUS) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	per = malloc(sizeof *per);
+	if (per == NULL)
+		return (NULL);
+
+	per->radius = radius;
+	for (d = 0; d <= PERIMETER_MAX_RADIUS; d++)
+		cps_init(per->layers + d);
+
+	return (per);
+}
+
+/*
+ * Generate a perimeter of the given radius by a breadth first search
+ * from the solved configuration.  If f is not NULL, print progress
+ * information to f.  On failure, return NULL and set errno.
+ */
+extern struct perimeter *
+perimeter_generate(int radius, FILE *f)
+{
+	struct perimeter *per;
+	struct compact_puzzle cp;
+	int d;
+
+	per = perimeter_allocate(radius);
+	if (per == NULL)
+		return (NULL);
+
+	pack_puzzle(&cp, &solved_puzzle);
+	cps_append(per->layers + 0, &cp);
+
+	for (d = 1; d <= radius; d++) {
+		cps_round(per->layers + d, per->layers + d - 1);
+
+		if (f != NULL)
+			fprintf(f, "Perimeter layer %2d: %zu configurations\n",
+			    d, per->layers[d].len);
+	}
+
+	return (per);
+}
+
+/*
+ * Load a perimeter from perimfile, which must have been written by
+ * perimeter_store().  On failure, return NULL and set errno.  A file
+ * that is not a perimeter file or is truncated is rejected with EINVAL.
+ */
+extern struct perimeter *
+perimeter_load(FILE *perimfile)
+{
+	struct perimeter_header header;
+	struct perimeter *per;
+	size_t count, len;
+	int d, error;
+
+	if (fread(&header, sizeof header, 1, perimfile) != 1) {
+		if (!ferror(perimfile))
+			errno = EINVAL;
+
+		return (NULL);
+	}
+
+	if (memcmp(header.magic, perimeter_magic, sizeof header.magic) != 0
+	    || header.radius > PERIMETER_MAX_RADIUS) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	per = perimeter_allocate((int)header.radius);
+	if (per == NULL)
+		return (NULL);
+
+	for (d = 0; d <= per->radius; d++) {
+		len = header.len[d];
+		per->layers[d].data = malloc(len * sizeof *per->layers[d].data);
+		if (per->layers[d].data == NULL && len > 0)
+			goto fail;
+
+		per->layers[d].len = per->layers[d].cap = len;
+
+		count = fread(per->layers[d].data, sizeof *per->layers[d].data, len, perimfile);
+		if (count != len) {
+			if (!ferror(perimfile))
+				errno = EINVAL;
+
+			goto fail;
+		}
+	}
+
+	return (per);
+
+fail:
+	error = errno;
+	perimeter_free(per);
+	errno = error;
+
+	return (NULL);
+}
+
+/*
+ * Write per to perimfile.  Return 0 on success, -1 on error.  Set
+ * errno to indicate the cause on error.
+ */
+extern int
+perimeter_store(FILE *perimfile, const struct perimeter *per)
+{
+	struct perimeter_header header;
+	size_t count;
+	int d, error;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, perimeter_magic, sizeof header.magic);
+	header.radius = per->radius;
+	for (d = 0; d <= per->radius; d++)
+		header.len[d] = per->layers[d].len;
+
+	if (fwrite(&header, sizeof header, 1, perimfile) != 1)
+		goto fail;
+
+	for (d = 0; d <= per->radius; d++) {
+		count = fwrite(per->layers[d].data, sizeof *per->layers[d].data,
+		    per->layers[d].len, perimfile);
+		if (count != per->layers[d].len)
+			goto fail;
+	}
+
+	if (fflush(perimfile) == 0)
+		return (0);
+
+fail:
+	error = errno;
+	if (!ferror(perimfile))
+		error = ENOSPC;
+
+	errno = error;
+	return (-1);
+}
+
+/*
+ * Release all storage associated with per.
+ */
+extern void
+perimeter_free(struct perimeter *per)
+{
+	int d;
+
+	for (d = 0; d <= PERIMETER_MAX_RADIUS; d++)
+		cps_free(per->layers + d);
+
+	free(per);
+}
+
+/*
+ * Return 1 if a is less than or equal to b, ignoring the move masks.
+ */
+static inline int
+cp_lessequal(const struct compact_puzzle *a, const struct compact_puzzle *b)
+{
+	return (a->hi < b->hi
+	    || (a->hi == b->hi && (a->lo & ~MOVE_MASK) <= (b->lo & ~MOVE_MASK)));
+}
+
+/*
+ * Binary search for key in layer and return a pointer to the matching
+ * entry or NULL if there is none.  Unlike bsearch(), this does not
+ * branch on the comparisons, which are unpredictable.
+ */
+static const struct compact_puzzle *
+find_in_layer(const struct cp_slice *layer, const struct compact_puzzle *key)
+{
+	const struct compact_puzzle *base = layer->data;
+	size_t len = layer->len, half;
+
+	if (len == 0)
+		return (NULL);
+
+	for (; len > 1; len -= half) {
+		half = len / 2;
+		base = cp_lessequal(base + half, key) ? base + half : base;
+	}
+
+	return (compare_cp_nomask(base, key) == 0 ? base : NULL);
+}
+
+/*
+ * Look up p in per.  h must be a lower bound for the distance of p
+ * from the solved configuration; layers closer than h are not
+ * searched.  If p is found, return its distance and, if mask is not
+ * NULL, store the move mask of p to *mask.  Otherwise return -1.
+ */
+extern int
+perimeter_distance(const struct perimeter *per, const struct puzzle *p,
+    int h, int *mask)
+{
+	struct compact_puzzle cp;
+	const struct compact_puzzle *found;
+	int d;
+
+	pack_puzzle(&cp, p);
+
+	/* only layers of the right parity can contain p */
+	if (h < 0)
+		h = 0;
+
+	for (d = h + ((h ^ distance_parity(p)) & 1); d <= per->radius; d += 2) {
+		found = find_in_layer(per->layers + d, &cp);
+		if (found == NULL)
+			continue;
+
+		if (mask != NULL)
+			*mask = move_mask(found);
+
+		return (d);
+	}
+
+	return (-1);
+}
+
+/*
+ * Return the Manhattan distance of p from the solved configuration.
+ * This is a lower bound for the distance of p with the same parity
+ * and lets us skip the layers of the perimeter that cannot contain p.
+ */
+static int
+manhattan_distance(const struct puzzle *p)
+{
+	/* the row and column of each grid location */
+	static const unsigned char rows[TILE_COUNT] = {
+		0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2,
+		3, 3, 3, 3, 3, 4, 4, 4, 4, 4,
+	}, cols[TILE_COUNT] = {
+		0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4,
+		0, 1, 2, 3, 4, 0, 1, 2, 3, 4,
+	};
+	int i, d = 0;
+
+	for (i = 1; i < TILE_COUNT; i++)
+		d += abs(rows[p->tiles[i]] - rows[i]) + abs(cols[p->tiles[i]] - cols[i]);
+
+	return (d);
+}
+
+/*
+ * Return an admissible and consistent h value for p derived from per:
+ * the exact distance of p if p lies within the perimeter, otherwise
+ * the least distance a configuration outside of the perimeter can
+ * have or the Manhattan distance of p, whichever is larger.  h must
+ * be a lower bound for the distance of p; layers closer than h are
+ * not searched.
+ */
+extern int
+perimeter_lookup(const struct perimeter *per, const struct puzzle *p, int h)
+{
+	int d, md, bound;
+
+	md = manhattan_distance(p);
+	if (h < md)
+		h = md;
+
+	if (h <= per->radius) {
+		d = perimeter_distance(per, p, h, NULL);
+		if (d >= 0)
+			return (d);
+	}
+
+	bound = perimeter_bound(per, distance_parity(p));
+
+	return (md > bound ? md : bound);
+}
+
+/* number of configurations looked up at once by perimeter_lookups() */
+enum { PERIMETER_CHUNK = 64 };
+
+/*
+ * Binary search for the n configurations in keys in layer and set
+ * found[i] to 1 if keys[i] is in layer and 0 otherwise.  As the length
+ * of the remaining interval is the same for all searches, they are
+ * carried out in lock step.  The loads of different searches do not
+ * depend on each other, so their cache misses are serviced in
+ * parallel instead of one after another.
+ */
+static void
+search_layer(const struct cp_slice *layer, const struct compact_puzzle *keys,
+    size_t n, int *found)
+{
+	const struct compact_puzzle *base[PERIMETER_CHUNK];
+	size_t i, len = layer->len, half;
+
+	if (len == 0) {
+		for (i = 0; i < n; i++)
+			found[i] = 0;
+
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		base[i] = layer->data;
+
+	for (; len > 1; len -= half) {
+		half = len / 2;
+		for (i = 0; i < n; i++)
+			base[i] = cp_lessequal(base[i] + half, keys + i) ? base[i] + half : base[i];
+	}
+
+	for (i = 0; i < n; i++)
+		found[i] = compare_cp_nomask(base[i], keys + i) == 0;
+}
+
+/*
+ * Look up the n configurations p in per as if by perimeter_lookup()
+ * with h = 0 and store the results to hvals[0], hvals[stride],
+ * hvals[2 * stride], and so on.  Configurations are processed in
+ * chunks, each layer being searched for all configurations of the
+ * chunk that could be in it at once.
+ */
+extern void
+perimeter_lookups(const struct perimeter *per, unsigned char *hvals,
+    size_t stride, const struct puzzle *p, size_t n)
+{
+	struct compact_puzzle pending[PERIMETER_CHUNK], keys[PERIMETER_CHUNK];
+	size_t i, j, k, len, n_pending, n_keys;
+	size_t pending_idx[PERIMETER_CHUNK], keys_idx[PERIMETER_CHUNK];
+	int md[PERIMETER_CHUNK], found[PERIMETER_CHUNK], d, bound;
+
+	for (i = 0; i < n; i += len) {
+		len = n - i < PERIMETER_CHUNK ? n - i : PERIMETER_CHUNK;
+
+		/* assume all configurations to be outside of the perimeter */
+		n_pending = 0;
+		for (j = 0; j < len; j++) {
+			md[j] = manhattan_distance(p + i + j);
+			bound = perimeter_bound(per, distance_parity(p + i + j));
+			hvals[(i + j) * stride] = md[j] > bound ? md[j] : bound;
+
+			if (md[j] <= per->radius) {
+				pack_puzzle(pending + n_pending, p + i + j);
+				pending_idx[n_pending++] = j;
+			}
+		}
+
+		for (d = 0; d <= per->radius && n_pending > 0; d++) {
+			n_keys = 0;
+			for (k = 0; k < n_pending; k++) {
+				j = pending_idx[k];
+				if (md[j] > d || (md[j] ^ d) & 1)
+					continue;
+
+				keys[n_keys] = pending[k];
+				keys_idx[n_keys++] = k;
+			}
+
+			if (n_keys == 0)
+				continue;
+
+			search_layer(per->layers + d, keys, n_keys, found);
+
+			/* record configurations found, drop them from pending */
+			for (k = 0; k < n_keys; k++)
+				if (found[k]) {
+					hvals[(i + pending_idx[keys_idx[k]]) * stride] = d;
+					pending_idx[keys_idx[k]] = SIZE_MAX;
+				}
+
+			for (j = k = 0; k < n_pending; k++)
+				if (pending_idx[k] != SIZE_MAX) {
+					pending[j] = pending[k];
+					pending_idx[j++] = pending_idx[k];
+				}
+
+			n_pending = j;
+		}
+	}
+}
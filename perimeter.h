@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* perimeter.h -- configurations close to the solved configuration */
+
+#ifndef PERIMETER_H
+#define PERIMETER_H
+
+#include <stdio.h>
+
+#include "compact.h"
+#include "puzzle.h"
+
+/*
+ * A perimeter holds all puzzle configurations within radius moves of
+ * the solved configuration together with their exact distances.
+ * layers[d] holds the configurations d moves away from the solved
+ * configuration, sorted by compare_cp.  The move mask of each
+ * configuration indicates which moves lead one step closer to the
+ * solved configuration, as computed by cps_round().  The size of the
+ * layers grows roughly by a factor of 2.1 per move, a perimeter of
+ * radius 20 takes about 450 MB of storage.
+ */
+enum { PERIMETER_MAX_RADIUS = 32 };
+
+struct perimeter {
+	int radius;
+	struct cp_slice layers[PERIMETER_MAX_RADIUS + 1];
+};
+
+extern struct perimeter	*perimeter_generate(int, FILE *);
+extern struct perimeter	*perimeter_load(FILE *);
+extern int		 perimeter_store(FILE *, const struct perimeter *);
+extern void		 perimeter_free(struct perimeter *);
+extern int		 perimeter_distance(const struct perimeter *, const struct puzzle *, int, int *);
+extern int		 perimeter_lookup(const struct perimeter *, const struct puzzle *, int);
+extern void		 perimeter_lookups(const struct perimeter *, unsigned char *, size_t,
+			     const struct puzzle *, size_t);
+
+/*
+ * Return the parity of the distance of p from the solved
+ * configuration.  As each move changes the colour of the square the
+ * zero tile is on when the tray is coloured like a chess board, this
+ * is the colour of the square the zero tile is on.
+ */
+static inline int
+distance_parity(const struct puzzle *p)
+{
+	int zloc = zero_location(p);
+
+	return ((zloc / 5 + zloc % 5) & 1);
+}
+
+/*
+ * Return a lower bound for the distance of a configuration with
+ * distance parity parity not contained in perimeter per.
+ */
+static inline int
+perimeter_bound(const struct perimeter *per, int parity)
+{
+	return (per->radius + 1 + ((per->radius + 1 ^ parity) & 1));
+}
+
+#endif /* PERIMETER_H */
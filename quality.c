@@ -27,12 +27,14 @@
 
 #include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "puzzle.h"
 #include "tileset.h"
 #include "index.h"
 #include "pdb.h"
+#include "parallel.h"
 #include "statistics.h"
 
 /*
@@ -52,37 +54,141 @@ region_bias(tileset ts)
 }
 
 /*
- * Compute eta for a complete pattern database.  Works for both APDBs
- * and ZPDBs.
+ * State for a parallel quality computation.  As the terms contributed
+ * by each cohort (i.e. each combination of maprank and eqidx) are
+ * computed in no particular order, they are stored in eta_terms and
+ * hsum_terms indexed by cohort number and summed up afterwards in
+ * the same order a sequential scan would have.  This way, the result
+ * is independent of the number of threads.  If eta_terms is NULL,
+ * the terms are instead added to eta and hsum directly.  This is only
+ * valid if the cohorts are visited in order by a single thread.
  */
-extern double
-pdb_eta(struct patterndb *pdb)
+struct quality_config {
+	struct parallel_config pcfg;
+	double *eta_terms, *hsum_terms;
+	double eta, hsum;
+};
+
+/*
+ * Compute a histogram of the n PDB entries in table.  Four separate
+ * histograms are used so consecutive increments of the same bucket
+ * do not have to wait for each other.
+ */
+static void
+table_histogram(size_t histogram[PDB_HISTOGRAM_LEN],
+    const unsigned char *table, size_t n)
 {
-	const struct index_aux *aux = &pdb->aux;
-	double eta = 0.0;
-	struct index idx;
+	size_t i, h[4][PDB_HISTOGRAM_LEN];
 
-	idx.pidx = 0;
+	memset(h, 0, sizeof h);
 
-	for (idx.maprank = 0; idx.maprank < aux->n_maprank; idx.maprank++)
-		for (idx.eqidx = 0; idx.eqidx < eqclass_count(aux, idx.maprank); idx.eqidx++) {
-			size_t i, histogram[PDB_HISTOGRAM_LEN];
-			double map_eta = 0.0;
-			const unsigned char *table;
+	for (i = 0; i + 4 <= n; i += 4) {
+		h[0][table[i + 0]]++;
+		h[1][table[i + 1]]++;
+		h[2][table[i + 2]]++;
+		h[3][table[i + 3]]++;
+	}
 
-			memset(histogram, 0, sizeof histogram);
-			table = (const unsigned char *)pdb_entry_pointer(pdb, &idx);
+	for (; i < n; i++)
+		h[0][table[i]]++;
 
-			for (i = 0; i < aux->n_perm; i++)
-				histogram[table[i]]++;
+	for (i = 0; i < PDB_HISTOGRAM_LEN; i++)
+		histogram[i] = h[0][i] + h[1][i] + h[2][i] + h[3][i];
+}
 
-			for (i = 0; i < PDB_HISTOGRAM_LEN; i++)
-				map_eta = histogram[PDB_HISTOGRAM_LEN - i - 1] + map_eta / B;
+/*
+ * Compute the eta and h sum terms for all cohorts of idx->maprank.
+ */
+static void
+quality_worker(void *cfgarg, struct index *idx)
+{
+	struct quality_config *cfg = cfgarg;
+	const struct index_aux *aux = &cfg->pcfg.pdb->aux;
+	size_t i, cohort, histogram[PDB_HISTOGRAM_LEN];
+	long long unsigned map_hsum;
+	double map_eta, bias;
+	const unsigned char *table;
+
+	for (idx->eqidx = 0; idx->eqidx < eqclass_count(aux, idx->maprank); idx->eqidx++) {
+		table = (const unsigned char *)pdb_entry_pointer(cfg->pcfg.pdb, idx);
+		table_histogram(histogram, table, aux->n_perm);
+
+		map_eta = 0.0;
+		map_hsum = 0;
+		for (i = 0; i < PDB_HISTOGRAM_LEN; i++) {
+			map_eta = histogram[PDB_HISTOGRAM_LEN - i - 1] + map_eta / B;
+			map_hsum += i * histogram[i];
+		}
+
+		bias = region_bias(eqclass_from_index(aux, idx));
+		if (cfg->eta_terms == NULL) {
+			cfg->eta += map_eta * bias;
+			cfg->hsum += map_hsum * bias;
+		} else {
+			cohort = index_offset(aux, idx) / aux->n_perm;
+			cfg->eta_terms[cohort] = map_eta * bias;
+			cfg->hsum_terms[cohort] = map_hsum * bias;
+		}
+	}
+}
+
+/*
+ * Compute eta and the average h value for a complete pattern database
+ * using pdb_jobs threads and store them to *eta and *h_average.  Works
+ * for both APDBs and ZPDBs.  The results are the same regardless of
+ * the number of threads used.
+ */
+extern void
+pdb_quality(struct patterndb *pdb, double *eta, double *h_average)
+{
+	struct quality_config cfg;
+	const struct index_aux *aux = &pdb->aux;
+	struct index idx;
+	size_t i, n_cohort = eqclass_total(aux);
+	double norm;
+
+	cfg.pcfg.pdb = pdb;
+	cfg.pcfg.worker = quality_worker;
+	cfg.eta = 0.0;
+	cfg.hsum = 0.0;
+	cfg.eta_terms = NULL;
+
+	if (pdb_jobs > 1)
+		cfg.eta_terms = malloc(2 * n_cohort * sizeof *cfg.eta_terms);
+
+	/* if we are single threaded or out of memory, do it sequentially */
+	if (cfg.eta_terms == NULL) {
+		for (idx.maprank = 0; idx.maprank < aux->n_maprank; idx.maprank++) {
+			idx.pidx = 0;
+			quality_worker(&cfg, &idx);
+		}
+	} else {
+		cfg.hsum_terms = cfg.eta_terms + n_cohort;
+		pdb_iterate_parallel(&cfg.pcfg);
 
-			eta += map_eta * region_bias(eqclass_from_index(aux, &idx));
+		for (i = 0; i < n_cohort; i++) {
+			cfg.eta += cfg.eta_terms[i];
+			cfg.hsum += cfg.hsum_terms[i];
 		}
 
-	eta /= (double)aux->n_perm * (TILE_COUNT - aux->n_tile) * (double)aux->n_maprank;
+		free(cfg.eta_terms);
+	}
+
+	norm = (double)aux->n_perm * (TILE_COUNT - aux->n_tile) * (double)aux->n_maprank;
+	*eta = cfg.eta / norm;
+	*h_average = cfg.hsum / norm;
+}
+
+/*
+ * Compute eta for a complete pattern database.  Works for both APDBs
+ * and ZPDBs.
+ */
+extern double
+pdb_eta(struct patterndb *pdb)
+{
+	double eta, h_average;
+
+	pdb_quality(pdb, &eta, &h_average);
 
 	return (eta);
 }
@@ -94,26 +200,9 @@ pdb_eta(struct patterndb *pdb)
 extern double
 pdb_h_average(struct patterndb *pdb)
 {
-	const struct index_aux *aux = &pdb->aux;
-	double hsum = 0.0;
-	struct index idx;
-
-	idx.pidx = 0;
-
-	for (idx.maprank = 0; idx.maprank < aux->n_maprank; idx.maprank++)
-		for (idx.eqidx = 0; idx.eqidx < eqclass_count(aux, idx.maprank); idx.eqidx++) {
-			long long unsigned map_hsum = 0;
-			size_t i;
-			const unsigned char *table;
-
-			table = (const unsigned char *)pdb_entry_pointer(pdb, &idx);
-			for (i = 0; i < aux->n_perm; i++)
-				map_hsum += table[i];
-
-			hsum += map_hsum * region_bias(eqclass_from_index(aux, &idx));
-		}
+	double eta, h_average;
 
-	hsum /= (double)aux->n_perm * (TILE_COUNT - aux->n_tile) * (double)aux->n_maprank;
+	pdb_quality(pdb, &eta, &h_average);
 
-	return (hsum);
+	return (h_average);
 }
@@ -33,95 +33,181 @@
 #include "index.h"
 #include "random.h"
 
-/* the default random seed.  Taken from /dev/random. */
-#define DEFAULT_SEED { \
-	0xf8c53aa7, 0x16a4b97b, 0x13ed4568, 0x120e6496, \
-	0x77bb4a8a, 0xeb39eae5, 0x46555774, 0x76d53591, \
-	0x64f9b515, 0xc5185564, 0x76b545d0, 0xd02bebe1, \
-	0xc73982f9, 0x5cc173a7, 0xb7002b87, 0x44d93488, \
-	0xe42e0343, 0x19525a6c, 0x38005946, 0x3a92c714, \
-	0x713da8b0, 0xad0d7988, 0x0788d23a, 0xd756c34c, \
-	0x8d38a159, 0x47c83127, 0x65c0e1b3, 0x141c0dd6, \
-	0xef0fea11, 0x4248804d, 0x19dd12ef, 0xe3c9b5da, \
-}
+/*
+ * The default random seed.  Used if set_seed() is never called.  Taken
+ * from /dev/random.
+ */
+#define DEFAULT_SEED 0xf8c53aa716a4b97bull
+
+/*
+ * The stream number used for the global random number generator.  This
+ * is chosen such that it does not collide with the stream numbers
+ * callers are likely to use for their own streams.
+ */
+#define GLOBAL_STREAM (~0ull)
+
+/*
+ * The seed all streams are derived from.  This is only written by
+ * set_seed() and must not be changed while other threads derive
+ * streams from it.
+ */
+static unsigned long long base_seed = DEFAULT_SEED;
 
-/* the current state of the random number generator */
-static unsigned int seed_v[32] = DEFAULT_SEED;
-static unsigned char seed_i = 0;
+/* the state of the global random number generator */
+static struct random_state global_state;
+static int global_seeded = 0;
 
-/* a mutex guarding the seed */
+/* a mutex guarding the global random number generator */
 pthread_mutex_t seed_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
- * Transition the random number generator by one step.  Return the
- * random number gained.  seed must be locked before calling this
- * function.  This function implements a WELL random number generator
- * as given by Wikipedia:
+ * Rotate x to the left by k bits.
+ */
+static inline unsigned long long
+rotl(unsigned long long x, int k)
+{
+	return (x << k | x >> 64 - k);
+}
+
+/*
+ * Compute the output of the splitmix64 generator for counter value x.
+ * This is used to expand the seed into the state of a stream as
+ * recommended by the authors of xoshiro256**:
  *
- * https://de.wikipedia.org/w/index.php?title=Well_Equidistributed_Long-period_Linear&oldid=179828249
+ * http://prng.di.unimi.it/splitmix64.c
  */
-static unsigned int
-random_step(void)
+static unsigned long long
+splitmix64(unsigned long long x)
 {
-	unsigned int z0, z1, z2, V0, VM1, VM2, VM3, VRm1;
-
-	V0   = seed_v[seed_i];
-	VM1  = seed_v[seed_i +  3 & 31];
-	VM2  = seed_v[seed_i + 24 & 31];
-	VM3  = seed_v[seed_i + 10 & 31];
-	VRm1 = seed_v[seed_i + 31 & 31];
-
-	z0 = VRm1;
-	z1 = V0 ^ VM1 ^ VM1 >>  8; 
-	z2 = (VM2 ^ VM2 << 19 ^ VM3 ^ VM3 << 14) & 0xffffffff;
-	seed_v[seed_i] = z1 ^ z2;
-	seed_v[seed_i + 31 & 31] = (z0 ^ z0 << 11 ^ z1 ^ z1 << 7 ^ z2 ^ z2 << 13) & 0xffffffff;
-	seed_i = seed_i + 31 & 31;
-
-	return (seed_v[seed_i]);
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ x >> 27) * 0x94d049bb133111ebull;
+
+	return (x ^ x >> 31);
 }
 
 /*
- * Seed the random number generator with newseed.
+ * Initialize rs to the random stream with number stream derived from
+ * the seed last passed to set_seed().  Different stream numbers yield
+ * independent streams, so each thread (or each unit of work) can draw
+ * from its own stream without any locking.  As the streams only depend
+ * on the seed and the stream number, results are reproducible if work
+ * is assigned to stream numbers deterministically.  The first word
+ * of the stream state is splitmix64(seed ^ splitmix64(stream)), each
+ * further word is splitmix64 of the one before.  As splitmix64 is a
+ * bijection, no two streams share their first word and thus their
+ * starting state.
  */
 extern void
-set_seed(unsigned long long newseed)
+random_stream(struct random_state *rs, unsigned long long stream)
 {
-	static const unsigned int default_seed[32] = DEFAULT_SEED;
-	int err, i;
+	size_t i;
+
+	rs->s[0] = splitmix64(base_seed ^ splitmix64(stream));
+	for (i = 1; i < 4; i++)
+		rs->s[i] = splitmix64(rs->s[i - 1]);
+}
+
+/*
+ * Transition the random number generator rs by one step.  Return the
+ * random number gained.  This function implements the xoshiro256**
+ * random number generator as given by its authors:
+ *
+ * http://prng.di.unimi.it/xoshiro256starstar.c
+ */
+extern unsigned long long
+random64_r(struct random_state *rs)
+{
+	unsigned long long *s = rs->s, result, t;
+
+	result = rotl(s[1] * 5, 7) * 9;
+	t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return (result);
+}
+
+/*
+ * Compute a random 32 bit number from rs.  As the low bits of
+ * xoshiro256** are slightly weaker, the high bits are used.
+ */
+extern unsigned int
+random32_r(struct random_state *rs)
+{
+	return (random64_r(rs) >> 32);
+}
+
+/*
+ * Lock the global random number generator and return a pointer to its
+ * state.  Seed it with the default seed if set_seed() has not been
+ * called yet.
+ */
+static struct random_state *
+lock_global_state(void)
+{
+	int err;
 
 	err = pthread_mutex_lock(&seed_lock);
 	assert(err == 0);
 
-	memcpy(seed_v, default_seed, 32 * sizeof *seed_v);
-	seed_v[0] = newseed >>  0 & 0xffffffff;
-	seed_v[1] = newseed >> 32 & 0xffffffff;
-	seed_i = 0;
+	if (!global_seeded) {
+		random_stream(&global_state, GLOBAL_STREAM);
+		global_seeded = 1;
+	}
+
+	return (&global_state);
+}
 
-	/* mix the seed bytes into the rest of the state */
-	for (i = 0; i < 1000; i++)
-		random_step();
+/*
+ * Release the lock on the global random number generator.
+ */
+static void
+unlock_global_state(void)
+{
+	int err;
 
 	err = pthread_mutex_unlock(&seed_lock);
 	assert(err == 0);
 }
 
 /*
- * Compute a random 32 bit number.  This function is MT-safe.
+ * Seed the random number generator with newseed.  This also changes
+ * the streams random_stream() hands out, so it should be called before
+ * any threads are started.
  */
-extern unsigned int
-random32(void)
+extern void
+set_seed(unsigned long long newseed)
 {
-	unsigned int r;
 	int err;
 
 	err = pthread_mutex_lock(&seed_lock);
 	assert(err == 0);
 
-	r = random_step();
+	base_seed = newseed;
+	random_stream(&global_state, GLOBAL_STREAM);
+	global_seeded = 1;
 
 	err = pthread_mutex_unlock(&seed_lock);
 	assert(err == 0);
+}
+
+/*
+ * Compute a random 32 bit number.  This function is MT-safe.
+ */
+extern unsigned int
+random32(void)
+{
+	unsigned int r;
+
+	r = random32_r(lock_global_state());
+	unlock_global_state();
 
 	return (r);
 }
@@ -132,41 +218,31 @@ random32(void)
 extern unsigned long long
 random64(void)
 {
-	unsigned int r1, r2;
-	int err;
-
-	err = pthread_mutex_lock(&seed_lock);
-	assert(err == 0);
-
-	r1 = random_step();
-	r2 = random_step();
+	unsigned long long r;
 
-	err = pthread_mutex_unlock(&seed_lock);
-	assert(err == 0);
+	r = random64_r(lock_global_state());
+	unlock_global_state();
 
-	return ((unsigned long long)r1 << 32 | r2);
+	return (r);
 }
 
 /*
- * Set p to a random puzzle configuration drawn from random_seed.  Note
- * that since a puzzle configuration has 82.7 bits of entropy but we
- * only extract 64 bits of entry from the RNG, not all puzzle
- * configurations are guaranteed to be generated.
+ * Set p to a random puzzle configuration drawn from rs.  Note that
+ * since a puzzle configuration has 82.7 bits of entropy but we only
+ * extract 128 bits of entropy from the RNG, not all puzzle
+ * configurations are generated with exactly the same probability.
  */
 extern void
-random_puzzle(struct puzzle *p)
+random_puzzle_r(struct random_state *rs, struct puzzle *p)
 {
 	__uint128_t rnd;
 	unsigned long long rnd1, rnd2;
 	size_t i, j, parity = 0;
-	int ipos, jpos, err;
+	int ipos, jpos;
 
 	/* silence valgrind as we technically read uninitialized values */
 	memset(p, 0, sizeof *p);
 
-	err = pthread_mutex_lock(&seed_lock);
-	assert(err == 0);
-
 	/*
 	 * Since we consume many of the 128 bits of entropy we get, we
 	 * must be careful to avoid modulo bias.  This is done by
@@ -174,17 +250,12 @@ random_puzzle(struct puzzle *p)
 	 * clean multiple of the range we are interested in.
 	 */
 	do {
-		rnd = 0;
-		for (i = 0; i < 4; i++)
-			rnd = rnd << 32 | random_step();
+		rnd = (__uint128_t)random64_r(rs) << 64 | random64_r(rs);
 
 		/* 23 * 24 * 25! */
 	} while (rnd >= (__uint128_t)39742454749 * 23 * 24 *
 		    2432902008176640000ULL * 6375600ULL /* 25! */);
 
-	err = pthread_mutex_unlock(&seed_lock);
-	assert(err == 0);
-
 	rnd1 = rnd % 2432902008176640000ULL; /* 1 * 2 * ... * 20 */
 	rnd2 = rnd / 2432902008176640000ULL;
 
@@ -231,13 +302,25 @@ random_puzzle(struct puzzle *p)
 }
 
 /*
- * Set i to a random index relative to aux.  This function also draws
- * its randomness from random_seed.
+ * Set p to a random puzzle configuration drawn from the global random
+ * number generator.  This function is MT-safe.
  */
 extern void
-random_index(const struct index_aux *aux, struct index *idx)
+random_puzzle(struct puzzle *p)
+{
+	random_puzzle_r(lock_global_state(), p);
+	unlock_global_state();
+}
+
+/*
+ * Set i to a random index relative to aux.  Draw the randomness
+ * from rs.
+ */
+extern void
+random_index_r(struct random_state *rs, const struct index_aux *aux,
+    struct index *idx)
 {
-	unsigned long long rnd = random64();
+	unsigned long long rnd = random64_r(rs);
 	tileset tsnz = tileset_remove(aux->ts, ZERO_TILE);
 
 	idx->pidx = rnd % factorials[tileset_count(tsnz)];
@@ -252,24 +335,33 @@ random_index(const struct index_aux *aux, struct index *idx)
 }
 
 /*
- * Perform an n step random walk from p, using fsm to prune moves.
- * Return 1 if the random walk was successful, 0 otherwise.  A random
- * walk is unsuccessful if the fsm at some point doesn't provide us
- * with a move to progress.
+ * Set i to a random index relative to aux.  This function draws
+ * its randomness from the global random number generator.
+ */
+extern void
+random_index(const struct index_aux *aux, struct index *idx)
+{
+	random_index_r(lock_global_state(), aux, idx);
+	unlock_global_state();
+}
+
+/*
+ * Perform an n step random walk from p, using fsm to prune moves and
+ * drawing randomness from rs.  Return 1 if the random walk was
+ * successful, 0 otherwise.  A random walk is unsuccessful if the fsm
+ * at some point doesn't provide us with a move to progress.
  */
 extern int
-random_walk(struct puzzle *p, int steps, const struct fsm *fsm)
+random_walk_r(struct random_state *rs, struct puzzle *p, int steps,
+    const struct fsm *fsm)
 {
 	struct fsm_state st;
-	unsigned int entropy;
-	int err, res = 0, i, n_move, reservoir = 0;
+	unsigned long long entropy;
+	int i, n_move, reservoir;
 	signed char moves[4];
 
-	err = pthread_mutex_lock(&seed_lock);
-	assert(err == 0);
-
-	entropy = random_step();
-	reservoir = 16;
+	entropy = random64_r(rs);
+	reservoir = 32;
 
 	st = fsm_start_state(zero_location(p));
 
@@ -277,7 +369,7 @@ random_walk(struct puzzle *p, int steps, const struct fsm *fsm)
 		n_move = fsm_get_moves_moribund(moves, st, fsm, steps);
 
 		switch (n_move) {
-		case 0:	goto fail; /* cannot proceed */
+		case 0:	return (0); /* cannot proceed */
 
 		case 1: i = 0; /* no choice to make */
 			break;
@@ -285,8 +377,8 @@ random_walk(struct puzzle *p, int steps, const struct fsm *fsm)
 		default:
 			do {
 				if (reservoir == 0) {
-					entropy = random_step();
-					reservoir = 16;
+					entropy = random64_r(rs);
+					reservoir = 32;
 				}
 
 				i = entropy & 3;
@@ -300,10 +392,22 @@ random_walk(struct puzzle *p, int steps, const struct fsm *fsm)
 		steps--;
 	}
 
-	res = 1;
+	return (1);
+}
 
-fail:	err = pthread_mutex_unlock(&seed_lock);
-	assert(err == 0);
+/*
+ * Perform an n step random walk from p like random_walk_r(), but draw
+ * randomness from the global random number generator.  The random
+ * number generator is only locked to draw a seed for a private stream,
+ * so concurrent random walks do not serialise.
+ */
+extern int
+random_walk(struct puzzle *p, int steps, const struct fsm *fsm)
+{
+	struct random_state rs;
+
+	random_stream(&rs, random64_r(lock_global_state()));
+	unlock_global_state();
 
-	return (res);
+	return (random_walk_r(&rs, p, steps, fsm));
 }
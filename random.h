@@ -30,6 +30,18 @@
 #include "index.h"
 #include "fsm.h"
 
+/*
+ * The state of one stream of random numbers.  Streams are obtained
+ * from random_stream() and derived from the seed set with set_seed().
+ * A stream must not be used by multiple threads at once, but
+ * different streams can be used concurrently without any locking.
+ * The functions without _r suffix draw from a global stream guarded
+ * by a mutex instead.
+ */
+struct random_state {
+	unsigned long long s[4];
+};
+
 extern void	set_seed(unsigned long long);
 extern unsigned long long	random64(void);
 extern unsigned int		random32(void);
@@ -37,4 +49,11 @@ extern void	random_puzzle(struct puzzle *);
 extern void	random_index(const struct index_aux *, struct index *);
 extern int	random_walk(struct puzzle *, int, const struct fsm *);
 
+extern void	random_stream(struct random_state *, unsigned long long);
+extern unsigned long long	random64_r(struct random_state *);
+extern unsigned int		random32_r(struct random_state *);
+extern void	random_puzzle_r(struct random_state *, struct puzzle *);
+extern void	random_index_r(struct random_state *, const struct index_aux *, struct index *);
+extern int	random_walk_r(struct random_state *, struct puzzle *, int, const struct fsm *);
+
 #endif /* RANDOM_H */
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* samplefile.c -- memory mapped sample files */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pdb.h"
+#include "samplefile.h"
+
+/* the page size we align ranges to */
+enum { PAGE_SIZE = 4096 };
+
+/*
+ * Open the sample file filename containing records of recsize bytes
+ * each and map it into memory.  On success, fill in sf and return 0.
+ * On failure, set errno and return -1.  A file whose length is not a
+ * multiple of recsize is rejected with EINVAL as it has likely been
+ * truncated or contains records of a different type.
+ */
+extern int
+samplefile_open(struct sample_file *sf, const char *filename, size_t recsize)
+{
+	struct stat st;
+	void *data;
+	int fd, error;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return (-1);
+
+	if (fstat(fd, &st) != 0)
+		goto fail;
+
+	if (st.st_size % recsize != 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	sf->len = st.st_size;
+	sf->recsize = recsize;
+	sf->n_record = st.st_size / recsize;
+
+	/* mmap() refuses to map empty files */
+	if (sf->len == 0) {
+		sf->data = NULL;
+		close(fd);
+
+		return (0);
+	}
+
+	data = mmap(NULL, sf->len, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		goto fail;
+
+	close(fd);
+
+	/* each thread reads its range front to back */
+	posix_madvise(data, sf->len, POSIX_MADV_SEQUENTIAL);
+	sf->data = data;
+
+	return (0);
+
+fail:	error = errno;
+	close(fd);
+	errno = error;
+
+	return (-1);
+}
+
+/*
+ * Unmap the sample file sf.  The content of sf is undefined afterwards.
+ */
+extern void
+samplefile_close(struct sample_file *sf)
+{
+	if (sf->data != NULL)
+		munmap((void *)sf->data, sf->len);
+}
+
+/*
+ * The range of records processed by one thread.
+ */
+struct samplefile_job {
+	struct samplefile_config *cfg;
+	size_t begin, end;
+	int job;
+};
+
+/*
+ * Process the records in the range described by jobarg in chunks of
+ * SAMPLEFILE_CHUNK records.
+ */
+static void *
+samplefile_worker(void *jobarg)
+{
+	struct samplefile_job *job = jobarg;
+	const struct sample_file *sf = job->cfg->sf;
+	size_t i, n;
+
+	for (i = job->begin; i < job->end; i += n) {
+		n = job->end - i < SAMPLEFILE_CHUNK ? job->end - i : SAMPLEFILE_CHUNK;
+		job->cfg->worker(job->cfg, job->job, sf->data + i * sf->recsize, n);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Compute the number of records such that the records of a range
+ * beginning at a multiple of this number start at a page boundary.
+ */
+static size_t
+record_alignment(size_t recsize)
+{
+	size_t a = PAGE_SIZE, b = recsize, t;
+
+	/* a = gcd(PAGE_SIZE, recsize) */
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return (PAGE_SIZE / a);
+}
+
+/*
+ * Process the records in cfg->sf in parallel using pdb_jobs threads
+ * as described in samplefile.h.  Thread j is passed j as its job
+ * number.  Threads whose range ends up empty are not called at all.
+ */
+extern void
+samplefile_iterate_parallel(struct samplefile_config *cfg)
+{
+	pthread_t pool[PDB_MAX_JOBS];
+	struct samplefile_job jobs[PDB_MAX_JOBS];
+	size_t align, n_record = cfg->sf->n_record;
+	int i, error;
+
+	align = record_alignment(cfg->sf->recsize);
+	for (i = 0; i < pdb_jobs; i++) {
+		jobs[i].cfg = cfg;
+		jobs[i].job = i;
+		jobs[i].begin = n_record * i / pdb_jobs / align * align;
+	}
+
+	for (i = 0; i < pdb_jobs - 1; i++)
+		jobs[i].end = jobs[i + 1].begin;
+
+	jobs[pdb_jobs - 1].end = n_record;
+
+	/* for easier debugging, don't multithread when jobs == 1 */
+	if (pdb_jobs == 1) {
+		samplefile_worker(jobs);
+		return;
+	}
+
+	/* spawn threads */
+	for (i = 0; i < pdb_jobs; i++) {
+		error = pthread_create(pool + i, NULL, samplefile_worker, jobs + i);
+		if (error == 0)
+			continue;
+
+		errno = error;
+		perror("pthread_create");
+		abort();
+	}
+
+	/* collect threads */
+	for (i = 0; i < pdb_jobs; i++) {
+		error = pthread_join(pool[i], NULL);
+		if (error == 0)
+			continue;
+
+		errno = error;
+		perror("pthread_join");
+		abort();
+	}
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* samplefile.h -- memory mapped sample files */
+
+#ifndef SAMPLEFILE_H
+#define SAMPLEFILE_H
+
+#include <stddef.h>
+
+/*
+ * A sample file is an array of fixed-size records, such as struct
+ * sample (as written by spheresample) or struct compact_puzzle (as
+ * written by samplegen).  The file is mapped into memory read-only so
+ * the records can be accessed without copying.  The member n_record
+ * holds the number of records in the file.  It may be reduced by the
+ * caller to only process a prefix of the file.
+ */
+struct sample_file {
+	const unsigned char *data;	/* mapped file content */
+	size_t len;			/* length of the mapping */
+	size_t recsize;			/* size of one record */
+	size_t n_record;		/* number of records to process */
+};
+
+/*
+ * samplefile_iterate_parallel() splits the records of sf into pdb_jobs
+ * ranges of consecutive records, one per thread, and calls worker for
+ * each chunk of up to SAMPLEFILE_CHUNK records in each range.  The
+ * second argument to worker is the number of the thread (counting from
+ * 0) so results can be accumulated per thread and merged in a
+ * deterministic order afterwards.  Range boundaries are aligned such
+ * that no two threads touch the same page of the file.  Extra data can
+ * be passed to worker by making struct samplefile_config the first
+ * member of a larger structure like this:
+ *
+ *     struct my_config {
+ *         struct samplefile_config sfcfg;
+ *         struct my_accumulator accums[PDB_MAX_JOBS];
+ *         ...
+ *     }
+ */
+enum { SAMPLEFILE_CHUNK = 1024 };
+
+struct samplefile_config {
+	const struct sample_file *sf;
+
+	/* worker function */
+	void (*worker)(void *, int, const void *, size_t);
+};
+
+extern int	samplefile_open(struct sample_file *, const char *, size_t);
+extern void	samplefile_close(struct sample_file *);
+extern void	samplefile_iterate_parallel(struct samplefile_config *);
+
+#endif /* SAMPLEFILE_H */
@@ -28,11 +28,16 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 
 #include "puzzle.h"
 #include "catalogue.h"
 #include "fsm.h"
+#include "perimeter.h"
+#include "perfcount.h"
+#include "ttable.h"
 
 /*
  * All search functions receive an array to store the path they found
@@ -55,6 +60,82 @@ enum {
 	IDA_VERBOSE = 1 << 1,
 	/* verify that a correct path was found */
 	IDA_VERIFY = 1 << 2,
+	/* search children with smaller h values first, not with IDA_LAST_FULL */
+	IDA_ORDER = 1 << 3,
+	/* count hardware events, print them per round with IDA_VERBOSE */
+	IDA_PERF = 1 << 4,
+};
+
+/*
+ * Statistics about a run of search_ida_config().  bound is the length
+ * of the solution found or, if none was found, a lower bound for it.
+ * lower_bound is a proven lower bound for the length of an optimal
+ * solution, which equals bound unless a suboptimal search was used.
+ * predicted_nodes and predicted_seconds are the estimated cost of the
+ * round that would come after the last round searched, extrapolated
+ * from the growth of the node count between rounds.  Both are 0 if
+ * no node exceeded the bound of the last round, i.e. the search space
+ * is exhausted and bound is SIZE_MAX.  With IDA_PERF,
+ * perf holds the hardware events counted during the search, leaving
+ * out those of threads helping through ida_pool_help().
+ * out_of_budget and limited are set if the search gave up because
+ * the budget would have been exceeded or because a limit was reached
+ * or the search was cancelled, respectively.
+ */
+struct ida_stats {
+	size_t bound, lower_bound;
+	unsigned long long expanded;
+	double seconds, predicted_nodes, predicted_seconds;
+	struct perf_values perf;
+	int out_of_budget, limited;
+};
+
+/*
+ * A round of search_ida_config(): its bound, the number of nodes
+ * expanded, and the wall-clock time taken in seconds.
+ */
+struct ida_round {
+	size_t bound;
+	unsigned long long expanded;
+	double seconds;
+};
+
+/*
+ * A pool of threads helping concurrent searches.  A search whose
+ * struct ida_config points to the pool opens each of its rounds to the
+ * threads that call ida_pool_help() on the pool, which join in on the
+ * subtrees of the round not yet searched.  searches counts the searches
+ * announced with ida_pool_enter(), helpers stop once it drops to zero.
+ * jobs is the number of threads a round should have enough subtrees
+ * for.  The other members are private.
+ */
+struct split;
+struct ida_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct split *splits;
+	int searches, jobs;
+};
+
+/*
+ * Optional search aids for search_ida_config().  Members set to NULL
+ * or 0 are not used, so a zero-initialised struct ida_config yields
+ * the behaviour of search_ida_bounded().
+ */
+struct ida_config {
+	const struct perimeter *perimeter;	/* perimeter around the goal */
+	struct ttable *ttable;			/* transposition table */
+	struct ida_stats *stats;		/* where to store statistics */
+	double budget;				/* seconds the search may take */
+	unsigned long long node_limit;		/* nodes the search may expand */
+	double time_limit;			/* wall-clock seconds likewise */
+	atomic_int *cancel;			/* give up once nonzero */
+	int jobs;				/* threads per round */
+	void **payloads;			/* per-thread on_solved payloads */
+	void (*merge)(void *, void *);		/* merge a thread's payload */
+	struct ida_pool *pool;			/* threads helping out */
+	void (*on_round)(const struct ida_round *, void *); /* round done */
+	void *round_payload;			/* payload for on_round */
 };
 
 struct path {
@@ -70,5 +151,17 @@ extern void	 path_walk(struct puzzle *, const struct path *);
 /* various */
 extern unsigned long long	search_ida(struct pdb_catalogue *, const struct fsm *, const struct puzzle *, struct path *, void (*)(const struct path *, void *), void *, int);
 extern unsigned long long	search_ida_bounded(struct pdb_catalogue *, const struct fsm *, const struct puzzle *, size_t, struct path *, void (*)(const struct path *, void *), void *, int);
+extern unsigned long long	search_ida_config(struct pdb_catalogue *, const struct fsm *, const struct ida_config *, const struct puzzle *, size_t, struct path *, void (*)(const struct path *, void *), void *, int);
+extern void	ida_pool_init(struct ida_pool *, int);
+extern void	ida_pool_destroy(struct ida_pool *);
+extern void	ida_pool_enter(struct ida_pool *);
+extern void	ida_pool_leave(struct ida_pool *);
+extern void	ida_pool_help(struct ida_pool *);
+
+/* wida.c */
+extern unsigned long long	search_ida_weighted(struct pdb_catalogue *, const struct fsm *, double, const struct puzzle *, size_t, struct path *, struct ida_stats *, int);
+
+/* bidir.c */
+extern unsigned long long	search_bidir(struct pdb_catalogue *, const struct fsm *, const struct puzzle *, size_t, struct path *, void (*)(const struct path *, void *), void *, int);
 
 #endif /* SEARCH_H */
@@ -81,4 +81,65 @@ struct sample {
 	double p;
 };
 
+/*
+ * A running accumulator for weighted observations.  This computes the
+ * weighted mean and the weighted sum of squared deviations from the
+ * mean in a single pass using West's algorithm, avoiding the
+ * cancellation the textbook formula suffers from.  Accumulators filled
+ * by different threads can be combined with accum_merge() using the
+ * pairwise update of Chan et al.  Weights must be positive.
+ */
+struct accumulator {
+	long long n;	/* number of observations */
+	double w;	/* sum of weights */
+	double mean;	/* weighted mean */
+	double m2;	/* weighted sum of squared deviations from mean */
+};
+
+/*
+ * Initialize acc to an empty accumulator.
+ */
+static inline void
+accum_init(struct accumulator *acc)
+{
+	acc->n = 0;
+	acc->w = 0.0;
+	acc->mean = 0.0;
+	acc->m2 = 0.0;
+}
+
+/*
+ * Add observation x with weight w to acc.
+ */
+static inline void
+accum_add(struct accumulator *acc, double x, double w)
+{
+	double delta;
+
+	acc->n++;
+	acc->w += w;
+	delta = x - acc->mean;
+	acc->mean += delta * w / acc->w;
+	acc->m2 += w * delta * (x - acc->mean);
+}
+
+/*
+ * Add the observations accumulated in b to a.
+ */
+static inline void
+accum_merge(struct accumulator *a, const struct accumulator *b)
+{
+	double w, delta;
+
+	w = a->w + b->w;
+	a->n += b->n;
+	if (w == 0.0)
+		return;
+
+	delta = b->mean - a->mean;
+	a->mean += delta * b->w / w;
+	a->m2 += b->m2 + delta * delta * a->w * b->w / w;
+	a->w = w;
+}
+
 #endif /* STATISTICS_H */
@@ -46,6 +46,7 @@
 #include "compact.h"
 #include "catalogue.h"
 #include "statistics.h"
+#include "samplefile.h"
 
 /*
  * eqdist_sizes[d] is the fraction of 24 puzzle configurations which take
@@ -92,26 +93,64 @@ enum { EQDIST_SIZES_LEN = sizeof eqdist_sizes / sizeof eqdist_sizes[0] };
 
 
 /*
- * Accumulate samples from sample file f into histogramm.  On IO error,
- * terminate the program.  Return the number of samples read from f.
+ * Configuration for evaluating a sample file.  Each thread counts the
+ * h values it sees into its own histogram.
+ */
+struct sample_config {
+	struct samplefile_config sfcfg;
+	struct pdb_catalogue *cat;
+	size_t histograms[PDB_MAX_JOBS][PDB_HISTOGRAM_LEN];
+};
+
+/*
+ * Accumulate the n samples in records into the histogram for job.
+ */
+static void
+sample_worker(void *cfgarg, int job, const void *records, size_t n)
+{
+	struct sample_config *cfg = cfgarg;
+	struct puzzle ps[SAMPLEFILE_CHUNK];
+	unsigned hvals[SAMPLEFILE_CHUNK];
+	size_t i;
+
+	unpack_puzzles(ps, records, sizeof(struct compact_puzzle), n);
+	catalogue_hvals(hvals, cfg->cat, ps, n);
+	for (i = 0; i < n; i++)
+		cfg->histograms[job][hvals[i]]++;
+}
+
+/*
+ * Accumulate samples from the sample file sf into histogram, splitting
+ * the file into pdb_jobs ranges of records evaluated in parallel.
+ * Return the number of samples read from the file.
  */
 static size_t
-do_samples(size_t histogram[PDB_HISTOGRAM_LEN], FILE *samplefile, const char *filename,
+do_samples(size_t histogram[PDB_HISTOGRAM_LEN], const struct sample_file *sf,
     struct pdb_catalogue *cat)
 {
-	struct puzzle p;
-	struct compact_puzzle cp;
-	size_t n_samples = 0;
-
-	while (fread(&cp, sizeof cp, 1, samplefile) == 1) {
-		n_samples++;
-		unpack_puzzle(&p, &cp);
-		histogram[catalogue_hval(cat, &p)]++;
+	struct sample_config *cfg;
+	size_t i, n_samples = 0;
+	int j;
+
+	cfg = calloc(1, sizeof *cfg);
+	if (cfg == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
 	}
 
-	/* ignore errors but do report them */
-	if (ferror(samplefile))
-		perror(filename);
+	cfg->sfcfg.sf = sf;
+	cfg->sfcfg.worker = sample_worker;
+	cfg->cat = cat;
+
+	samplefile_iterate_parallel(&cfg->sfcfg);
+
+	for (j = 0; j < pdb_jobs; j++)
+		for (i = 0; i < PDB_HISTOGRAM_LEN; i++) {
+			histogram[i] += cfg->histograms[j][i];
+			n_samples += cfg->histograms[j][i];
+		}
+
+	free(cfg);
 
 	return (n_samples);
 }
@@ -167,9 +206,10 @@ compute_eta(struct pdb_catalogue *cat, const char *prefix, size_t threshold,
     int brief, FILE *f)
 {
 	struct stat_file stats;
-	FILE *statfile, *samplefile;
+	FILE *statfile;
 	double eta = 0.0, eta_d, weight;
 	size_t histogram[PDB_HISTOGRAM_LEN], n_samples, d;
+	struct sample_file sf;
 	int use;
 	char pathbuf[PATH_MAX];
 
@@ -197,15 +237,14 @@ compute_eta(struct pdb_catalogue *cat, const char *prefix, size_t threshold,
 			continue;
 
 		snprintf(pathbuf, PATH_MAX, "%s.%zu", prefix, d);
-		samplefile = fopen(pathbuf, "rb");
-		if (samplefile == NULL) {
+		if (samplefile_open(&sf, pathbuf, sizeof(struct compact_puzzle)) != 0) {
 			perror(pathbuf);
 			continue;
 		}
 
 		memset(histogram, 0, sizeof histogram);
-		n_samples = do_samples(histogram, samplefile, pathbuf, cat);
-		fclose(samplefile);
+		n_samples = do_samples(histogram, &sf, cat);
+		samplefile_close(&sf);
 
 		use = n_samples >= threshold || d < EQDIST_SIZES_LEN;
 		eta_d = partial_eta(histogram, n_samples, use, brief, d, weight, f);
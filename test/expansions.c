@@ -98,6 +98,7 @@ expand(struct puzzle *p, int d, struct fsm_state st, struct partial_hvals *ph)
 static void *
 take_expansions(void *unused)
 {
+	struct random_state rs;
 	struct puzzle p;
 	struct partial_hvals ph;
 	struct fsm_state st;
@@ -107,8 +108,9 @@ take_expansions(void *unused)
 	(void)unused;
 
 	while (n = n_done++, n < n_puzzle) {
-		/* TODO: make this deterministic in concurrent operation */
-		random_puzzle(&p);
+		/* one stream per puzzle to be deterministic in concurrent operation */
+		random_stream(&rs, n);
+		random_puzzle_r(&rs, &p);
 
 		st = fsm_start_state(zero_location(&p));
 		catalogue_partial_hvals(&ph, cat, &p);
@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* orderbench.c -- measure the effect of move ordering on IDA* */
+
+/*
+ * For each instance read from standard input, run IDA* once with and
+ * once without IDA_ORDER and print the number of nodes expanded by
+ * either search.  Instances are given either one per line or in the
+ * format of doc/korf.txt where the instance is the first field
+ * containing a comma.  Lines not containing an instance are skipped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "catalogue.h"
+#include "fsm.h"
+#include "puzzle.h"
+#include "search.h"
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i] [-d pdbdir] [-l limit] [-m fsmfile] catalogue\n", argv0);
+
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Find the instance in line and parse it into p.  Return 0 on success,
+ * -1 if there is no instance in line.
+ */
+static int
+parse_instance(struct puzzle *p, const char *line)
+{
+	const char *comma, *start;
+
+	comma = strchr(line, ',');
+	if (comma == NULL)
+		return (-1);
+
+	for (start = comma; start > line && start[-1] != ' ' && start[-1] != '\t'; start--)
+		;
+
+	return (puzzle_parse(p, start));
+}
+
+extern int
+main(int argc, char *argv[])
+{
+	const struct fsm *fsm = &fsm_simple;
+	struct pdb_catalogue *cat;
+	struct path path;
+	struct puzzle p;
+	FILE *fsmfile;
+	unsigned long long plain, ordered, total_plain = 0, total_ordered = 0;
+	size_t limit = SEARCH_PATH_LEN, plain_len;
+	int optchar, catflags = 0, n = 0, better = 0, worse = 0;
+	char linebuf[1024], *pdbdir = NULL;
+
+	while (optchar = getopt(argc, argv, "d:il:m:"), optchar != -1)
+		switch (optchar) {
+		case 'd':
+			pdbdir = optarg;
+			break;
+
+		case 'i':
+			catflags |= CAT_IDENTIFY;
+			break;
+
+		case 'l':
+			limit = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'm':
+			fsmfile = fopen(optarg, "rb");
+			if (fsmfile == NULL) {
+				perror(optarg);
+				return (EXIT_FAILURE);
+			}
+
+			fsm = fsm_load(fsmfile);
+			if (fsm == NULL) {
+				perror("fsm_load");
+				return (EXIT_FAILURE);
+			}
+
+			fclose(fsmfile);
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+
+	if (argc != optind + 1)
+		usage(argv[0]);
+
+	cat = catalogue_load(argv[optind], pdbdir, catflags, stderr);
+	if (cat == NULL) {
+		perror("catalogue_load");
+		return (EXIT_FAILURE);
+	}
+
+	printf("%4s %4s %14s %14s %7s\n", "no", "dist", "plain", "ordered", "ratio");
+	while (fgets(linebuf, sizeof linebuf, stdin) != NULL) {
+		if (parse_instance(&p, linebuf) != 0)
+			continue;
+
+		n++;
+		plain = search_ida_bounded(cat, fsm, &p, limit, &path, NULL, NULL, 0);
+		plain_len = path.pathlen;
+		ordered = search_ida_bounded(cat, fsm, &p, limit, &path, NULL, NULL, IDA_ORDER);
+		if (path.pathlen != plain_len) {
+			fprintf(stderr, "Solution lengths differ for instance %d!\n", n);
+			return (EXIT_FAILURE);
+		}
+
+		total_plain += plain;
+		total_ordered += ordered;
+		better += ordered < plain;
+		worse += ordered > plain;
+
+		if (path.pathlen == SEARCH_NO_PATH)
+			printf("%4d %4s", n, "-");
+		else
+			printf("%4d %4zu", n, path.pathlen);
+
+		printf(" %14llu %14llu %7.4f\n", plain, ordered, (double)ordered / plain);
+		fflush(stdout);
+	}
+
+	printf("total     %14llu %14llu %7.4f\n", total_plain, total_ordered,
+	    (double)total_ordered / total_plain);
+	printf("ordering expanded fewer nodes for %d and more nodes for %d of %d instances\n",
+	    better, worse, n);
+
+	return (EXIT_SUCCESS);
+}
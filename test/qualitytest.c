@@ -79,11 +79,12 @@ static void *
 qualitytest_worker(void *qtcfg_arg)
 {
 	struct qualitytest_config *qtcfg = qtcfg_arg;
-	struct puzzle p;
-	struct partial_hvals ph;
+	struct random_state rs;
+	struct puzzle ps[CATALOGUE_BATCH_LEN];
+	struct partial_hvals ph[CATALOGUE_BATCH_LEN], tph[CATALOGUE_BATCH_LEN];
 	size_t histogram[PDB_HISTOGRAM_LEN] = {};
 	size_t bestheu[HEURISTICS_LEN] = {}, onlyheu[HEURISTICS_LEN] = {};
-	size_t i, j, n, old_progress;
+	size_t i, j, k, n, len, old_progress;
 	unsigned dist, tdist, heumap;
 
 	for (;;) {
@@ -95,18 +96,32 @@ qualitytest_worker(void *qtcfg_arg)
 		if (n > CHUNK_SIZE)
 			n = CHUNK_SIZE;
 
+		/* one stream per chunk so results don't depend on pdb_jobs */
+		random_stream(&rs, old_progress / CHUNK_SIZE);
+
 		for (i = 0; i < n; i++) {
-			random_puzzle(&p);
+			/* look up a batch of puzzles at once */
+			k = i % CATALOGUE_BATCH_LEN;
+			if (k == 0) {
+				len = n - i < CATALOGUE_BATCH_LEN ? n - i : CATALOGUE_BATCH_LEN;
+				for (j = 0; j < len; j++)
+					random_puzzle_r(&rs, ps + j);
 
-			catalogue_partial_hvals(&ph, qtcfg->cat, &p);
-			dist = catalogue_ph_hval(qtcfg->cat, &ph);
-			heumap = catalogue_max_heuristics(qtcfg->cat, &ph);
+				catalogue_partial_hvals_batch(ph, qtcfg->cat, ps, len);
 
-			if (qtcfg->transpose) {
-				transpose(&p);
+				if (qtcfg->transpose) {
+					for (j = 0; j < len; j++)
+						transpose(ps + j);
 
-				catalogue_partial_hvals(&ph, qtcfg->cat, &p);
-				tdist = catalogue_ph_hval(qtcfg->cat, &ph);
+					catalogue_partial_hvals_batch(tph, qtcfg->cat, ps, len);
+				}
+			}
+
+			dist = catalogue_ph_hval(qtcfg->cat, ph + k);
+			heumap = catalogue_max_heuristics(qtcfg->cat, ph + k);
+
+			if (qtcfg->transpose) {
+				tdist = catalogue_ph_hval(qtcfg->cat, tph + k);
 
 				if (tdist > dist) {
 					dist = tdist;
@@ -114,7 +129,7 @@ qualitytest_worker(void *qtcfg_arg)
 				}
 
 				if (tdist == dist)
-					heumap |= catalogue_max_heuristics(qtcfg->cat, &ph);
+					heumap |= catalogue_max_heuristics(qtcfg->cat, tph + k);
 			}
 
 			histogram[dist]++;
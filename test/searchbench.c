@@ -0,0 +1,458 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* searchbench.c -- benchmark IDA* on a fixed set of instances */
+
+/*
+ * This program runs IDA* on a fixed subset of the instances from
+ * doc/korf.txt and doc/100-random.txt and prints the number of nodes
+ * expanded, the search speed, the time taken by each round, the peak RSS
+ * and the page faults taken for each instance as JSON to stdout.  As
+ * most instances take far too long to solve for a benchmark, each
+ * search gives up after a node limit, which keeps the node counts
+ * reproducible.  If a baseline is given, which must be the output of
+ * an earlier run, each instance is compared against it and reported as
+ * a regression if it takes more time than the threshold permits or if
+ * the search made less progress.  For a search cut off by the node
+ * limit, the node count says nothing, so progress is measured by the
+ * bound reached and by the nodes of the last complete round.  The exit
+ * status is 1 if there are regressions.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "catalogue.h"
+#include "fsm.h"
+#include "puzzle.h"
+#include "search.h"
+
+/*
+ * The instances to benchmark.  These are the four instances from
+ * doc/korf.txt expanding the fewest nodes with Korf's heuristic and the
+ * first four instances from doc/100-random.txt.
+ */
+static const struct instance {
+	const char *name, *puzzle;
+} instances[] = {
+	{ "korf-38", "10,3,24,12,0,7,8,11,14,21,22,23,2,1,9,17,18,6,20,4,13,15,5,19,16" },
+	{ "korf-40", "2,17,4,13,7,12,10,3,0,16,21,24,8,5,18,20,15,19,14,9,22,11,6,1,23" },
+	{ "korf-25", "3,17,9,8,24,1,11,12,14,0,5,4,22,13,16,21,15,6,7,10,20,23,2,18,19" },
+	{ "korf-32", "1,12,18,13,17,15,3,7,20,0,19,24,6,5,21,11,2,8,9,16,22,10,4,23,14" },
+	{ "random-1", "2,13,5,4,1,22,24,21,9,3,18,19,8,11,10,16,14,7,20,0,23,12,15,17,6" },
+	{ "random-2", "1,11,8,14,18,3,6,21,22,5,24,9,16,20,23,7,13,10,4,12,2,19,17,0,15" },
+	{ "random-3", "20,0,7,23,13,10,16,17,2,19,9,8,18,14,6,4,15,5,1,24,3,22,12,11,21" },
+	{ "random-4", "7,22,14,19,23,10,0,5,21,4,13,6,2,18,9,8,16,15,1,17,11,24,12,20,3" },
+};
+
+enum {
+	N_INSTANCES = sizeof instances / sizeof *instances,
+	MAX_ROUNDS = SEARCH_PATH_LEN / 2,
+	DEFAULT_NODE_LIMIT = 100000000,
+};
+
+/*
+ * The outcome of searching one instance.  rss is the peak resident
+ * set size in kilobytes, the fault counts are those taken during the
+ * search.
+ */
+struct result {
+	struct ida_round rounds[MAX_ROUNDS];
+	size_t n_rounds, length, bound;
+	unsigned long long expanded;
+	double seconds;
+	long rss, minor_faults, major_faults;
+	int limited;
+};
+
+/*
+ * A result read from a baseline.  last_bound and last_expanded describe
+ * the last complete round or are zero if there was none.
+ */
+struct baseline {
+	char name[64];
+	unsigned long long expanded, last_expanded;
+	double seconds;
+	size_t lower_bound, last_bound;
+	int limited;
+};
+
+/*
+ * Record round in the result pointed to by resultarg.
+ */
+static void
+record_round(const struct ida_round *round, void *resultarg)
+{
+	struct result *result = resultarg;
+
+	if (result->n_rounds < MAX_ROUNDS)
+		result->rounds[result->n_rounds++] = *round;
+}
+
+/*
+ * Search p using cat and fsm, giving up after node_limit nodes, and
+ * store the outcome to result.
+ */
+static void
+run_instance(struct result *result, struct pdb_catalogue *cat,
+    const struct fsm *fsm, const struct puzzle *p,
+    unsigned long long node_limit)
+{
+	struct ida_config cfg = { 0 };
+	struct ida_stats stats;
+	struct path path;
+	struct rusage before, after;
+	struct timespec begin, end;
+
+	memset(result, 0, sizeof *result);
+	cfg.stats = &stats;
+	cfg.node_limit = node_limit;
+	cfg.on_round = record_round;
+	cfg.round_payload = result;
+
+	getrusage(RUSAGE_SELF, &before);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	result->expanded = search_ida_config(cat, fsm, &cfg, p, SEARCH_PATH_LEN,
+	    &path, NULL, NULL, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_SELF, &after);
+
+	result->seconds = (end.tv_sec - begin.tv_sec)
+	    + (end.tv_nsec - begin.tv_nsec) / 1000000000.0;
+	result->length = path.pathlen;
+	result->bound = stats.bound;
+	result->limited = stats.limited;
+	result->rss = after.ru_maxrss;
+	result->minor_faults = after.ru_minflt - before.ru_minflt;
+	result->major_faults = after.ru_majflt - before.ru_majflt;
+}
+
+/*
+ * Print result for the instance called name as a JSON object on a
+ * single line, so baselines can be read back line by line.
+ */
+static void
+print_result(const char *name, const struct result *result)
+{
+	size_t i;
+
+	printf("{ \"name\": \"%s\", ", name);
+	if (result->limited || result->length == SEARCH_NO_PATH)
+		printf("\"length\": null, ");
+	else
+		printf("\"length\": %zu, ", result->length);
+
+	printf("\"lower_bound\": %zu, \"limited\": %s, \"nodes\": %llu, "
+	    "\"seconds\": %.6f, \"nodes_per_second\": %.0f, \"max_rss_kb\": %ld, "
+	    "\"minor_faults\": %ld, \"major_faults\": %ld, \"rounds\": [",
+	    result->bound, result->limited ? "true" : "false", result->expanded,
+	    result->seconds, result->expanded / result->seconds, result->rss,
+	    result->minor_faults, result->major_faults);
+
+	for (i = 0; i < result->n_rounds; i++)
+		printf("%s{ \"bound\": %zu, \"nodes\": %llu, \"seconds\": %.6f }",
+		    i == 0 ? " " : ", ", result->rounds[i].bound,
+		    result->rounds[i].expanded, result->rounds[i].seconds);
+
+	printf(" ] }");
+}
+
+/*
+ * Read the per instance results from the JSON file baselinefile as
+ * written by print_result() into bl, which has room for n entries.
+ * Return the number of entries read.  Terminate on error.
+ */
+static size_t
+read_baseline(struct baseline *bl, size_t n, const char *baselinefile)
+{
+	FILE *f;
+	size_t i = 0;
+	char linebuf[16384], *name, *nodes, *seconds, *lower_bound, *round, *r;
+
+	f = fopen(baselinefile, "r");
+	if (f == NULL) {
+		perror(baselinefile);
+		exit(EXIT_FAILURE);
+	}
+
+	while (i < n && fgets(linebuf, sizeof linebuf, f) != NULL) {
+		/* the instance's own fields come before those of the rounds */
+		name = strstr(linebuf, "\"name\": \"");
+		nodes = strstr(linebuf, "\"nodes\": ");
+		seconds = strstr(linebuf, "\"seconds\": ");
+		lower_bound = strstr(linebuf, "\"lower_bound\": ");
+		if (name == NULL || nodes == NULL || seconds == NULL || lower_bound == NULL)
+			continue;
+
+		/* find the last round */
+		round = NULL;
+		for (r = strstr(linebuf, "{ \"bound\": "); r != NULL; r = strstr(r + 1, "{ \"bound\": "))
+			round = r;
+
+		bl[i].last_bound = 0;
+		bl[i].last_expanded = 0;
+		if (round != NULL && sscanf(round, "{ \"bound\": %zu, \"nodes\": %llu",
+		    &bl[i].last_bound, &bl[i].last_expanded) != 2)
+			continue;
+
+		bl[i].limited = strstr(linebuf, "\"limited\": true") != NULL;
+		if (sscanf(name, "\"name\": \"%63[^\"]\"", bl[i].name) == 1
+		    && sscanf(nodes, "\"nodes\": %llu", &bl[i].expanded) == 1
+		    && sscanf(seconds, "\"seconds\": %lf", &bl[i].seconds) == 1
+		    && sscanf(lower_bound, "\"lower_bound\": %zu", &bl[i].lower_bound) == 1)
+			i++;
+	}
+
+	if (ferror(f)) {
+		perror(baselinefile);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(f);
+
+	return (i);
+}
+
+/*
+ * Compare the progress of the search in result with baseline b and
+ * print a message to stderr if it made less.  If both searches were
+ * solved, the search expanding more than node_threshold percent more
+ * nodes made less progress.  If both were cut off by the node limit,
+ * the search reaching a lower bound or expanding more than
+ * node_threshold percent more nodes in the same last complete round
+ * made less progress.  Return 1 if the search made less progress, 0
+ * otherwise.
+ */
+static int
+compare_progress(const char *name, const struct result *result,
+    const struct baseline *b, double node_threshold)
+{
+	const struct ida_round *last;
+	double change;
+
+	if (!result->limited && !b->limited) {
+		change = 100.0 * ((double)result->expanded / b->expanded - 1.0);
+		if (change > node_threshold) {
+			fprintf(stderr, "%s: %llu nodes, %+.2f%% from %llu in baseline\n",
+			    name, result->expanded, change, b->expanded);
+			return (1);
+		}
+
+		return (0);
+	}
+
+	/* solved now, but not in the baseline */
+	if (!result->limited)
+		return (0);
+
+	if (!b->limited) {
+		fprintf(stderr, "%s: not solved within the node limit, solved in baseline\n", name);
+		return (1);
+	}
+
+	if (result->bound < b->lower_bound) {
+		fprintf(stderr, "%s: reached bound %zu, %zu in baseline\n",
+		    name, result->bound, b->lower_bound);
+		return (1);
+	}
+
+	if (result->bound > b->lower_bound || result->n_rounds == 0)
+		return (0);
+
+	last = result->rounds + result->n_rounds - 1;
+	if (last->bound != b->last_bound)
+		return (0);
+
+	change = 100.0 * ((double)last->expanded / b->last_expanded - 1.0);
+	if (change > node_threshold) {
+		fprintf(stderr, "%s: %llu nodes in round with bound %zu, %+.2f%% from %llu in baseline\n",
+		    name, last->expanded, last->bound, change, b->last_expanded);
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Compare the result for the instance called name against the entry
+ * of the same name in bl and print a message to stderr if it made less
+ * progress than in the baseline as determined by compare_progress() or
+ * took more than time_threshold percent more time.  Return the number
+ * of regressions found.
+ */
+static int
+compare_result(const char *name, const struct result *result,
+    const struct baseline *bl, size_t n_bl, double node_threshold,
+    double time_threshold)
+{
+	size_t i;
+	double change;
+	int regressions = 0;
+
+	for (i = 0; i < n_bl; i++)
+		if (strcmp(bl[i].name, name) == 0)
+			break;
+
+	if (i == n_bl) {
+		fprintf(stderr, "%s: not in baseline\n", name);
+		return (0);
+	}
+
+	regressions += compare_progress(name, result, bl + i, node_threshold);
+
+	change = 100.0 * (result->seconds / bl[i].seconds - 1.0);
+	if (change > time_threshold) {
+		fprintf(stderr, "%s: %.3f seconds, %+.2f%% from %.3f in baseline\n",
+		    name, result->seconds, change, bl[i].seconds);
+		regressions++;
+	}
+
+	return (regressions);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i] [-b baseline] [-d pdbdir] [-m fsmfile] [-n nodes] [-t percent] [-x percent] catalogue\n", argv0);
+
+	exit(EXIT_FAILURE);
+}
+
+extern int
+main(int argc, char *argv[])
+{
+	const struct fsm *fsm = &fsm_simple;
+	struct pdb_catalogue *cat;
+	struct puzzle p;
+	struct result result, total;
+	struct baseline bl[N_INSTANCES + 1];
+	FILE *fsmfile;
+	unsigned long long node_limit = DEFAULT_NODE_LIMIT;
+	double node_threshold = 0.0, time_threshold = 10.0;
+	size_t i, n_bl = 0;
+	int optchar, catflags = 0, regressions = 0;
+	char *pdbdir = NULL, *baselinefile = NULL;
+
+	while (optchar = getopt(argc, argv, "b:d:im:n:t:x:"), optchar != -1)
+		switch (optchar) {
+		case 'b':
+			baselinefile = optarg;
+			break;
+
+		case 'd':
+			pdbdir = optarg;
+			break;
+
+		case 'i':
+			catflags |= CAT_IDENTIFY;
+			break;
+
+		case 'm':
+			fsmfile = fopen(optarg, "rb");
+			if (fsmfile == NULL) {
+				perror(optarg);
+				return (EXIT_FAILURE);
+			}
+
+			fsm = fsm_load(fsmfile);
+			if (fsm == NULL) {
+				perror("fsm_load");
+				return (EXIT_FAILURE);
+			}
+
+			fclose(fsmfile);
+			break;
+
+		case 'n':
+			node_limit = strtoull(optarg, NULL, 0);
+			break;
+
+		case 't':
+			time_threshold = strtod(optarg, NULL);
+			break;
+
+		case 'x':
+			node_threshold = strtod(optarg, NULL);
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+
+	if (argc != optind + 1)
+		usage(argv[0]);
+
+	if (baselinefile != NULL)
+		n_bl = read_baseline(bl, N_INSTANCES + 1, baselinefile);
+
+	cat = catalogue_load(argv[optind], pdbdir, catflags, stderr);
+	if (cat == NULL) {
+		perror("catalogue_load");
+		return (EXIT_FAILURE);
+	}
+
+	printf("{\n\"catalogue\": \"%s\",\n\"node_limit\": %llu,\n\"instances\": [\n",
+	    argv[optind], node_limit);
+
+	memset(&total, 0, sizeof total);
+	for (i = 0; i < N_INSTANCES; i++) {
+		puzzle_parse(&p, instances[i].puzzle);
+		run_instance(&result, cat, fsm, &p, node_limit);
+		print_result(instances[i].name, &result);
+		printf(i + 1 < N_INSTANCES ? ",\n" : "\n");
+		fflush(stdout);
+
+		if (baselinefile != NULL)
+			regressions += compare_result(instances[i].name, &result,
+			    bl, n_bl, node_threshold, time_threshold);
+
+		total.expanded += result.expanded;
+		total.seconds += result.seconds;
+		total.rss = result.rss;
+		total.minor_faults += result.minor_faults;
+		total.major_faults += result.major_faults;
+		total.limited |= result.limited;
+	}
+
+	/* the total has no length or rounds of its own */
+	total.length = SEARCH_NO_PATH;
+	printf("],\n\"total\": ");
+	print_result("total", &total);
+	printf("\n}\n");
+
+	if (baselinefile != NULL) {
+		regressions += compare_result("total", &total, bl, n_bl,
+		    node_threshold, time_threshold);
+		fprintf(stderr, "%d regression(s) against baseline %s\n",
+		    regressions, baselinefile);
+	}
+
+	return (regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
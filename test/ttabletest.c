@@ -0,0 +1,219 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* ttabletest.c -- check that transposition tables keep IDA* optimal */
+
+/*
+ * For each instance read from standard input, run IDA* without a
+ * transposition table and then with one in a number of configurations:
+ * plainly, with IDA_ORDER, and with the given number of threads
+ * sharing the table.  Print the solution length and node counts and
+ * fail if any configuration finds a longer solution than the search
+ * without a table.  As the table must not prune paths the finite state
+ * machine relies on, this check is most meaningful with a compiled
+ * finite state machine given with -m.  Instances are read as in
+ * test/orderbench.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "catalogue.h"
+#include "fsm.h"
+#include "puzzle.h"
+#include "search.h"
+#include "ttable.h"
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i] [-d pdbdir] [-j nproc] [-l limit] [-m fsmfile] [-T megabytes] catalogue\n", argv0);
+
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Find the instance in line and parse it into p.  Return 0 on success,
+ * -1 if there is no instance in line.
+ */
+static int
+parse_instance(struct puzzle *p, const char *line)
+{
+	const char *comma, *start;
+
+	comma = strchr(line, ',');
+	if (comma == NULL)
+		return (-1);
+
+	for (start = comma; start > line && start[-1] != ' ' && start[-1] != '\t'; start--)
+		;
+
+	return (puzzle_parse(p, start));
+}
+
+/* the configurations searched with a transposition table */
+enum {
+	TT_PLAIN,
+	TT_ORDER,
+	TT_PARALLEL,
+	TT_CONFIGS,
+};
+
+static const char *const config_names[TT_CONFIGS] = {
+	"table",
+	"ordered",
+	"parallel",
+};
+
+extern int
+main(int argc, char *argv[])
+{
+	const struct fsm *fsm = &fsm_simple;
+	struct ida_config plain = { 0 }, cfg;
+	struct pdb_catalogue *cat;
+	struct ttable *tt;
+	struct path path;
+	struct puzzle p;
+	FILE *fsmfile;
+	unsigned long long nodes[TT_CONFIGS + 1];
+	size_t limit = SEARCH_PATH_LEN, len, megabytes = 64;
+	int optchar, catflags = 0, jobs = 2, n = 0, failed = 0, i;
+	char linebuf[1024], *pdbdir = NULL;
+
+	while (optchar = getopt(argc, argv, "d:ij:l:m:T:"), optchar != -1)
+		switch (optchar) {
+		case 'd':
+			pdbdir = optarg;
+			break;
+
+		case 'i':
+			catflags |= CAT_IDENTIFY;
+			break;
+
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1 || jobs > PDB_MAX_JOBS) {
+				fprintf(stderr, "Number of threads must be between 1 and %d\n",
+				    PDB_MAX_JOBS);
+				return (EXIT_FAILURE);
+			}
+
+			break;
+
+		case 'l':
+			limit = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'm':
+			fsmfile = fopen(optarg, "rb");
+			if (fsmfile == NULL) {
+				perror(optarg);
+				return (EXIT_FAILURE);
+			}
+
+			fsm = fsm_load(fsmfile);
+			if (fsm == NULL) {
+				perror("fsm_load");
+				return (EXIT_FAILURE);
+			}
+
+			fclose(fsmfile);
+			break;
+
+		case 'T':
+			megabytes = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+
+	if (argc != optind + 1)
+		usage(argv[0]);
+
+	cat = catalogue_load(argv[optind], pdbdir, catflags, stderr);
+	if (cat == NULL) {
+		perror("catalogue_load");
+		return (EXIT_FAILURE);
+	}
+
+	/* one table shared by all searches, as pdbsearch does */
+	tt = ttable_create(megabytes << 20);
+	if (tt == NULL) {
+		perror("ttable_create");
+		return (EXIT_FAILURE);
+	}
+
+	printf("%4s %4s %14s %14s %14s %14s\n", "no", "dist", "plain",
+	    config_names[TT_PLAIN], config_names[TT_ORDER], config_names[TT_PARALLEL]);
+	while (fgets(linebuf, sizeof linebuf, stdin) != NULL) {
+		if (parse_instance(&p, linebuf) != 0)
+			continue;
+
+		n++;
+		nodes[0] = search_ida_config(cat, fsm, &plain, &p, limit, &path, NULL, NULL, 0);
+		len = path.pathlen;
+
+		for (i = 0; i < TT_CONFIGS; i++) {
+			cfg = plain;
+			cfg.ttable = tt;
+			if (i == TT_PARALLEL)
+				cfg.jobs = jobs;
+
+			nodes[i + 1] = search_ida_config(cat, fsm, &cfg, &p, limit, &path,
+			    NULL, NULL, i == TT_ORDER ? IDA_ORDER | IDA_VERIFY : IDA_VERIFY);
+			if (path.pathlen != len) {
+				fprintf(stderr, "Instance %d: %s search found length %zu instead of %zu!\n",
+				    n, config_names[i], path.pathlen, len);
+				failed++;
+			}
+		}
+
+		if (len == SEARCH_NO_PATH)
+			printf("%4d %4s", n, "-");
+		else
+			printf("%4d %4zu", n, len);
+
+		for (i = 0; i <= TT_CONFIGS; i++)
+			printf(" %14llu", nodes[i]);
+
+		printf("\n");
+		fflush(stdout);
+	}
+
+	ttable_free(tt);
+
+	if (failed > 0) {
+		printf("%d searches with a transposition table were not optimal\n", failed);
+		return (EXIT_FAILURE);
+	}
+
+	printf("all searches with a transposition table were optimal\n");
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,220 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* ttable.c -- transposition tables for IDA* */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compact.h"
+#include "ttable.h"
+
+/*
+ * Create a transposition table taking up about size bytes of storage.
+ * On failure, return NULL and set errno.
+ */
+extern struct ttable *
+ttable_create(size_t size)
+{
+	struct ttable *tt;
+	size_t i;
+	int error;
+
+	tt = malloc(sizeof *tt);
+	if (tt == NULL)
+		return (NULL);
+
+	tt->n_bucket = size / (TTABLE_WAYS * sizeof *tt->entries);
+	if (tt->n_bucket == 0)
+		tt->n_bucket = 1;
+
+	/* align the buckets to cache lines */
+	tt->entries = aligned_alloc(TTABLE_WAYS * sizeof *tt->entries,
+	    tt->n_bucket * TTABLE_WAYS * sizeof *tt->entries);
+	if (tt->entries == NULL) {
+		error = errno;
+		free(tt);
+		errno = error;
+		return (NULL);
+	}
+
+	/* all-zero entries never match as no puzzle packs to all zeroes */
+	for (i = 0; i < tt->n_bucket * TTABLE_WAYS; i++) {
+		atomic_init(&tt->entries[i].data, 0);
+		atomic_init(&tt->entries[i].aux, 0);
+		atomic_init(&tt->entries[i].lo, 0);
+		atomic_init(&tt->entries[i].hi, 0);
+	}
+
+	atomic_init(&tt->generation, 0);
+
+	return (tt);
+}
+
+/*
+ * Release all storage associated with tt.
+ */
+extern void
+ttable_free(struct ttable *tt)
+{
+	free(tt->entries);
+	free(tt);
+}
+
+/*
+ * Compute the bucket for cp in tt.
+ */
+static struct ttable_entry *
+ttable_bucket(struct ttable *tt, const struct compact_puzzle *cp)
+{
+	unsigned long long hash;
+
+	hash = (cp->lo ^ cp->hi * 0x9e3779b97f4a7c15ull) * 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 31;
+
+	return (tt->entries + (hash % tt->n_bucket) * TTABLE_WAYS);
+}
+
+/*
+ * Encode info into a data word and an aux word without the check
+ * value and back.
+ */
+static unsigned long long
+encode_info(const struct ttable_info *info)
+{
+	return ((unsigned long long)info->generation << 16 | info->g << 8 | info->hval);
+}
+
+static void
+decode_info(struct ttable_info *info, unsigned long long data,
+    unsigned long long aux)
+{
+	info->generation = data >> 16;
+	info->fsm_state = aux >> 32;
+	info->g = data >> 8 & 0xff;
+	info->hval = data & 0xff;
+}
+
+/*
+ * Compute the check value of an entry for cp with the given data word
+ * and FSM state.
+ */
+static unsigned long long
+entry_check(const struct compact_puzzle *cp, unsigned long long data,
+    unsigned fsm_state)
+{
+	unsigned long long hash;
+
+	hash = (cp->lo ^ data * 0x9e3779b97f4a7c15ull) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ hash >> 29 ^ cp->hi) * 0x94d049bb133111ebull;
+	hash = (hash ^ hash >> 32 ^ fsm_state) * 0xbf58476d1ce4e5b9ull;
+
+	return (hash >> 32);
+}
+
+/*
+ * Read entry e, checking it against cp.  If it matches, store its
+ * data and aux words to *data and *aux and return 1.  Otherwise
+ * return 0.
+ */
+static int
+entry_matches(struct ttable_entry *e, unsigned long long *data,
+    unsigned long long *aux, const struct compact_puzzle *cp)
+{
+	unsigned long long d, a;
+
+	d = atomic_load_explicit(&e->data, memory_order_relaxed);
+	a = atomic_load_explicit(&e->aux, memory_order_relaxed);
+	if ((atomic_load_explicit(&e->lo, memory_order_relaxed) ^ d) != cp->lo
+	    || (atomic_load_explicit(&e->hi, memory_order_relaxed) ^ d) != cp->hi
+	    || (a & 0xffffffffull) != entry_check(cp, d, a >> 32))
+		return (0);
+
+	*data = d;
+	*aux = a;
+	return (1);
+}
+
+/*
+ * Look up cp in tt.  The move mask of cp must be clear.  If an entry
+ * is found, store it to info and return 1.  Otherwise return 0.
+ */
+extern int
+ttable_lookup(struct ttable *tt, struct ttable_info *info,
+    const struct compact_puzzle *cp)
+{
+	struct ttable_entry *bucket = ttable_bucket(tt, cp);
+	unsigned long long data, aux;
+	size_t i;
+
+	for (i = 0; i < TTABLE_WAYS; i++)
+		if (entry_matches(bucket + i, &data, &aux, cp)) {
+			decode_info(info, data, aux);
+			return (1);
+		}
+
+	return (0);
+}
+
+/*
+ * Store info for cp in tt.  The move mask of cp must be clear.  If cp
+ * is already in the table, its entry is overwritten.  Otherwise, an
+ * entry from an older generation or, failing that, the entry farthest
+ * from the root is replaced.
+ */
+extern void
+ttable_store(struct ttable *tt, const struct ttable_info *info,
+    const struct compact_puzzle *cp)
+{
+	struct ttable_entry *bucket = ttable_bucket(tt, cp), *victim = bucket;
+	struct ttable_info old, victim_info;
+	unsigned long long data, aux;
+	size_t i;
+
+	decode_info(&victim_info, atomic_load_explicit(&bucket->data, memory_order_relaxed), 0);
+
+	for (i = 0; i < TTABLE_WAYS; i++) {
+		if (entry_matches(bucket + i, &data, &aux, cp)) {
+			victim = bucket + i;
+			break;
+		}
+
+		decode_info(&old, atomic_load_explicit(&bucket[i].data, memory_order_relaxed), 0);
+		if (victim_info.generation == info->generation
+		    && (old.generation != info->generation || old.g > victim_info.g)) {
+			victim = bucket + i;
+			victim_info = old;
+		}
+	}
+
+	data = encode_info(info);
+	aux = (unsigned long long)info->fsm_state << 32
+	    | entry_check(cp, data, info->fsm_state);
+	atomic_store_explicit(&victim->data, data, memory_order_relaxed);
+	atomic_store_explicit(&victim->aux, aux, memory_order_relaxed);
+	atomic_store_explicit(&victim->lo, cp->lo ^ data, memory_order_relaxed);
+	atomic_store_explicit(&victim->hi, cp->hi ^ data, memory_order_relaxed);
+}
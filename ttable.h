@@ -0,0 +1,99 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* ttable.h -- transposition tables for IDA* */
+
+#ifndef TTABLE_H
+#define TTABLE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "compact.h"
+#include "puzzle.h"
+
+/*
+ * A transposition table remembers configurations visited during an
+ * IDA* search, allowing the search to recognise configurations reached
+ * along multiple paths.  (This has nothing to do with the puzzle
+ * transposition of transposition.h.)  For each configuration, the
+ * table records a lower bound for its distance to the goal as backed
+ * up from a previous search of its subtree and, for the current search
+ * generation, the least depth at which the configuration has been
+ * searched and the FSM state it was searched in.  The table has a fixed size, entries are replaced by
+ * entries from newer generations and then by entries closer to the
+ * root.  A new generation number is drawn for every round of every
+ * search, so one table can be shared between multiple searches and
+ * threads.
+ *
+ * All accesses are lock free.  An entry consists of four words: the
+ * data, the FSM state together with a check value, and the two words
+ * of the key, each xored with the data.  The check value is a hash of
+ * key, data, and FSM state.  An entry is only considered a match if
+ * the key words recovered with the data word match the key looked up
+ * and the check value matches the entry's contents.  Entries torn
+ * apart by concurrent writes thus are treated as misses unless the
+ * 32 bit check value happens to collide.  Two entries make up one
+ * 64 byte bucket.
+ */
+struct ttable_entry {
+	_Atomic unsigned long long data, aux, lo, hi;
+};
+
+struct ttable {
+	struct ttable_entry *entries;
+	size_t n_bucket;
+	_Atomic unsigned generation;
+};
+
+/* number of entries per bucket */
+enum { TTABLE_WAYS = 2 };
+
+/*
+ * The information recorded for a configuration.  hval is a lower bound
+ * for the distance of the configuration to the goal.  g is the least
+ * depth the configuration was searched at during generation and
+ * fsm_state the state of the finite state machine it was searched in.
+ */
+struct ttable_info {
+	unsigned generation, fsm_state;
+	unsigned char g, hval;
+};
+
+extern struct ttable	*ttable_create(size_t);
+extern void		 ttable_free(struct ttable *);
+extern int		 ttable_lookup(struct ttable *, struct ttable_info *, const struct compact_puzzle *);
+extern void		 ttable_store(struct ttable *, const struct ttable_info *, const struct compact_puzzle *);
+
+/*
+ * Draw a new generation number for a round of a search using tt.
+ */
+static inline unsigned
+ttable_new_generation(struct ttable *tt)
+{
+	return (atomic_fetch_add_explicit(&tt->generation, 1, memory_order_relaxed) + 1);
+}
+
+#endif /* TTABLE_H */
@@ -0,0 +1,223 @@
+/*-
+ * Copyright (c) 2020 Robert Clausecker. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* wida.c -- weighted IDA* for bounded suboptimal solutions */
+
+/*
+ * Weighted IDA* searches with f(n) = g(n) + w h(n) for a weight
+ * w = 1 + epsilon/2.  As f(n) <= w (g(n) + h(n)) <= w C* holds for all
+ * nodes n on an optimal path of length C*, increasing the bound to
+ * the least f value exceeding it never takes it past w C*.  As the
+ * weighted f values are nearly all distinct, doing just that would
+ * take a huge number of rounds.  Instead, the bound is increased by
+ * at least epsilon/2 times the proven lower bound for C* each round,
+ * overshooting w C* by at most epsilon/2 C*.  Thus the solution found
+ * is at most (1 + epsilon) C* moves long.  f values are computed in
+ * fixed point with WEIGHT_SCALE as the unit.  The transposition table
+ * and perimeter of search_ida_config() are not supported as they
+ * store admissible values the weighted f values cannot be reconciled
+ * with.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalogue.h"
+#include "fsm.h"
+#include "puzzle.h"
+#include "search.h"
+
+enum { WEIGHT_SCALE = 256 };
+
+struct wida_state {
+	jmp_buf finish;
+	struct pdb_catalogue *cat;
+	const struct fsm *fsm;
+	struct path *path;
+	size_t bound, next_bound, weight;
+	unsigned long long expanded;
+};
+
+/*
+ * Expand the search tree for p, which has been reached after g moves,
+ * pruning nodes whose weighted f value exceeds wst->bound and keeping
+ * track of the least such value in wst->next_bound.  When a solution
+ * is found, store its length to wst->path and finish the search.
+ */
+static void
+wida_expand(struct wida_state *wst, size_t g, struct puzzle *p,
+    struct fsm_state st, struct partial_hvals *ph)
+{
+	struct partial_hvals pph;
+	struct fsm_state ast;
+	size_t i, h, f, n_moves, zloc, dest, tile;
+	const signed char *moves;
+
+	h = catalogue_ph_hval(wst->cat, ph);
+	f = g * WEIGHT_SCALE + h * wst->weight;
+	if (f > wst->bound) {
+		if (f < wst->next_bound)
+			wst->next_bound = f;
+
+		return;
+	}
+
+	if (h == 0 && memcmp(p->tiles, solved_puzzle.tiles, TILE_COUNT) == 0) {
+		wst->path->pathlen = g;
+		longjmp(wst->finish, 1);
+	}
+
+	/* a weighted search might take more moves than fit into a path */
+	if (g + 1 >= SEARCH_PATH_LEN)
+		return;
+
+	fsm_prefetch(wst->fsm, st);
+	wst->expanded++;
+	zloc = zero_location(p);
+	moves = get_moves(zloc);
+	n_moves = move_count(zloc);
+
+	for (i = 0; i < n_moves; i++) {
+		ast = fsm_advance_idx(wst->fsm, st, i);
+		if (fsm_is_match(ast))
+			continue;
+
+		dest = moves[i];
+		wst->path->moves[g] = dest;
+
+		tile = p->grid[dest];
+		move(p, dest);
+		pph = *ph;
+		catalogue_diff_hvals(&pph, wst->cat, p, tile);
+		wida_expand(wst, g + 1, p, ast, &pph);
+		move(p, zloc);
+	}
+}
+
+/*
+ * Search for a solution for p of at most (1 + epsilon) times the
+ * optimal length using weighted IDA* with the PDBs in cat as the
+ * heuristic and fsm to eliminate duplicate nodes.  Give up once the
+ * optimal solution is known to be longer than limit.  Store the path
+ * found in path or set path->pathlen to SEARCH_NO_PATH if none was
+ * found.  If stats is not NULL, store statistics to *stats, in
+ * particular the lower bound for the optimal solution length proven
+ * by the search.  Only IDA_VERBOSE and IDA_VERIFY are supported as
+ * flags.  Return the number of nodes expanded.
+ */
+extern unsigned long long
+search_ida_weighted(struct pdb_catalogue *cat, const struct fsm *fsm,
+    double epsilon, const struct puzzle *p, size_t limit, struct path *path,
+    struct ida_stats *stats, int flags)
+{
+	struct wida_state wst;
+	struct partial_hvals ph;
+	struct puzzle pp;
+	size_t h, lower_bound, step;
+	unsigned long long total_expanded = 0;
+	int found = 0;
+
+	wst.cat = cat;
+	wst.fsm = fsm;
+	wst.path = path;
+
+	/* round down so we do not exceed the permitted slack */
+	if (epsilon < 0.0)
+		epsilon = 0.0;
+
+	wst.weight = (size_t)floor((1.0 + 0.5 * epsilon) * WEIGHT_SCALE);
+
+	path->pathlen = SEARCH_NO_PATH;
+	catalogue_partial_hvals(&ph, cat, p);
+	h = catalogue_ph_hval(cat, &ph);
+	lower_bound = h;
+	wst.bound = h * wst.weight;
+
+	while (lower_bound <= limit) {
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Searching for solution with weighted bound %.3f\n",
+			    (double)wst.bound / WEIGHT_SCALE);
+
+		wst.next_bound = SIZE_MAX;
+		wst.expanded = 0;
+		pp = *p;
+		if (setjmp(wst.finish) == 0)
+			wida_expand(&wst, 0, &pp, fsm_start_state(zero_location(&pp)), &ph);
+		else
+			found = 1;
+
+		total_expanded += wst.expanded;
+		if (flags & IDA_VERBOSE)
+			fprintf(stderr, "Expanded %llu nodes during previous round.\n", wst.expanded);
+
+		if (found || wst.next_bound == SIZE_MAX)
+			break;
+
+		/*
+		 * An optimal solution of length at most bound / w would
+		 * have been found, so the optimal solution is longer.
+		 * Solution lengths have the same parity as h.
+		 */
+		lower_bound = wst.bound / wst.weight + 1;
+		lower_bound += lower_bound - h & 1;
+		step = (size_t)floor(0.5 * epsilon * lower_bound * WEIGHT_SCALE);
+		wst.bound = wst.next_bound > wst.bound + step ? wst.next_bound : wst.bound + step;
+	}
+
+	if (flags & IDA_VERBOSE) {
+		fprintf(stderr, "Expanded %llu nodes in total.\n", total_expanded);
+		if (found)
+			fprintf(stderr, "Found solution of length %zu, optimal solution has at least %zu moves.\n",
+			    path->pathlen, lower_bound);
+		else
+			fprintf(stderr, "No solution found, solution has at least %zu moves.\n",
+			    lower_bound);
+	}
+
+	if (found && flags & IDA_VERIFY) {
+		pp = *p;
+		path_walk(&pp, path);
+		if (memcmp(pp.tiles, solved_puzzle.tiles, TILE_COUNT) != 0) {
+			if (flags & IDA_VERBOSE)
+				fprintf(stderr, "Path incorrect!\n");
+
+			abort();
+		}
+	}
+
+	if (stats != NULL) {
+		memset(stats, 0, sizeof *stats);
+		stats->bound = found ? path->pathlen : lower_bound;
+		stats->lower_bound = lower_bound;
+		stats->expanded = total_expanded;
+	}
+
+	return (total_expanded);
+}